@@ -11,11 +11,16 @@
 
 #include <lcm/lcm.h>
 #include "raw_bytes_t.h"
+#include "raw_latency_t.h"
 
 #include "r2_epoch.h"
+#include "r2_trace.h"
+
+#include "publish.h"
 
 #define INPUT_SUFFIX "i"
 #define OUTPUT_SUFFIX "o"
+#define TRACE_SUFFIX "t"
 
 extern char **environ;
 
@@ -49,9 +54,61 @@ static speed_t char_to_baudrate( char *arg ) {
     }
 }
 
+// drain a trace ring and publish the summary as raw_latency_t, timing each
+// stage from the one before it (so the first stage, wake, has no entry)
+static int latency_publish( lcm_t * lio, const char * channel,
+        struct r2_trace_ring * ring, int64_t period ) {
+    static uint8_t buf[512];
+    struct r2_trace_summary summary;
+    r2_trace_summarize( ring, &summary );
+
+    raw_latency_t msg;
+    msg.utime = r2_epoch_usec_now();
+    msg.period = period;
+    msg.count = summary.count;
+    msg.dropped = summary.dropped;
+    msg.nstages = R2_TRACE_STAGES - 1;
+    msg.stage = (char **)( R2_TRACE_STAGE_NAMES + 1 );
+    msg.min = summary.min + 1;
+    msg.mean = summary.mean + 1;
+    msg.max = summary.max + 1;
+
+    int n = raw_latency_t_encode( buf, 0, sizeof( buf ), &msg );
+    if( n < 0 ) {
+        fputs( "could not encode latency summary\n", stderr );
+        return n;
+    }
+    return lcm_publish( lio, channel, buf, n );
+}
+
+// like raw_bytes_t_decode, but leaves msg->data pointing into buf instead of
+// allocating a copy
+static int raw_bytes_view( const void * buf, int size, raw_bytes_t * msg ) {
+    int64_t hash = 0;
+    int pos = 0;
+    int n = __int64_t_decode_array( buf, pos, size - pos, &hash, 1 );
+    if( n < 0 || hash != __raw_bytes_t_get_hash() ) return -1;
+    pos += n;
+    n = __int64_t_decode_array( buf, pos, size - pos, &(msg->utime), 1 );
+    if( n < 0 ) return n;
+    pos += n;
+    n = __int32_t_decode_array( buf, pos, size - pos, &(msg->length), 1 );
+    if( n < 0 ) return n;
+    pos += n;
+    if( msg->length < 0 || msg->length > size - pos ) return -1;
+    msg->data = (uint8_t *)buf + pos;
+    return pos + msg->length;
+}
+
+// subscribe with lcm_subscribe, user points to the serial file descriptor
 static void raw_handler( const lcm_recv_buf_t *rbuf, const char * channel,
-        const raw_bytes_t * msg, void * user ) {
-    write( *( (int *) user ), msg->data, msg->length );
+        void * user ) {
+    raw_bytes_t msg;
+    if( 0 > raw_bytes_view( rbuf->data, rbuf->data_size, &msg ) ) {
+        fprintf( stderr, "could not decode raw_bytes_t on %s\n", channel );
+        return;
+    }
+    write( *( (int *) user ), msg.data, msg.length );
 }
 
 #endif // _BRIDGES_H
@@ -2,6 +2,7 @@
 // ^ common header for both simple and complex bridge
 // #includes: config.h, lcm.h, raw_bytes_t.h, r2_epoch.h, etc.
 
+#include "shared.h"
 #include "complex.h"
 #include "r2_sio.h"
 
@@ -15,6 +16,7 @@ static void sio_handle( FILE * sio, const char * channel, lcm_t * lio ) {
 
     // TODO: check fgetc for EOF, etc.
     tmp[msg.length-1] = fgetc( sio );
+    R2_TRACE( R2_TRACE_READ );
 
     // only search for initiator if it is different from terminator
     if( args.initiator != args.terminator ) {
@@ -34,8 +36,13 @@ static void sio_handle( FILE * sio, const char * channel, lcm_t * lio ) {
             fprintf( stderr, "terminator not found, sending %d bytes\n",
                     msg.length );
             msg.data = tmp;
-            raw_bytes_t_publish( lio, channel, &msg );
+            R2_TRACE( R2_TRACE_FRAMED );
+            raw_bytes_publish( lio, channel, &msg, lcm_buffer,
+                    sizeof( lcm_buffer ) );
             msg.length = 0;
+            // the rest is a new record, timed from here
+            R2_TRACE( R2_TRACE_WAKE );
+            R2_TRACE( R2_TRACE_READ );
         }
         // TODO: check return value of fgetc
         tmp[msg.length] = fgetc( sio );
@@ -43,7 +50,9 @@ static void sio_handle( FILE * sio, const char * channel, lcm_t * lio ) {
     }
 
     msg.data = tmp;
-    raw_bytes_t_publish( lio, channel, &msg );
+    R2_TRACE( R2_TRACE_FRAMED );
+    if( demux ) channel = r2_demux_frame( demux, msg.data, msg.length );
+    raw_bytes_publish( lio, channel, &msg, lcm_buffer, sizeof( lcm_buffer ) );
 }
 
 
@@ -54,6 +63,10 @@ int main( int argc, char ** argv ) {
     args.initiator = args.terminator;
     argp_parse( &argp, argc, argv, 0, 0, &args );
 
+    if( args.shared.realtime ) {
+        setvbuf( stdout, stdout_buffer, _IOLBF, sizeof( stdout_buffer ) );
+    }
+
     if( 0 > cfsetispeed( &tio, args.baudrate ) || 0 > cfsetospeed( &tio, args.baudrate ) ) {
         fprintf( stderr, "error setting baudrate\n" );
     }
@@ -72,6 +85,7 @@ int main( int argc, char ** argv ) {
     if( NULL == sio ) {
         fprintf( stderr, "could not open serial port: %s\n", args.dev );
     }
+    setvbuf( sio, sio_buffer, _IOFBF, sizeof( sio_buffer ) );
     int sfd = fileno( sio );
     if( args.verbosity > 0 ) {
         printf( "opened serial port file stream with file descriptor %d\n", sfd );
@@ -99,12 +113,16 @@ int main( int argc, char ** argv ) {
     char output_channel[strlen( tty ) + strlen( OUTPUT_SUFFIX )];
     strcpy( output_channel, tty );
     strcat( output_channel, OUTPUT_SUFFIX );
+    char trace_channel[strlen( tty ) + strlen( TRACE_SUFFIX ) + 1];
+    strcpy( trace_channel, tty );
+    strcat( trace_channel, TRACE_SUFFIX );
     if( args.verbosity >= 0 ) {
         printf( "input channel: %s\n", input_channel );
         printf( "output channel: %s\n", output_channel );
     }
 
-    raw_bytes_t_subscribe( lio, input_channel, &raw_handler, (void *)&sfd );
+    shared_setup( &args.shared, args.verbosity, lio, &sfd, &tio,
+            input_channel, output_channel, trace_channel );
 
     // set up epoll to listen for input
     struct epoll_event ev = { 0 };
@@ -135,9 +153,16 @@ int main( int argc, char ** argv ) {
     } else if ( args.verbosity > 0 ) {
         printf( "added LCM fd %d to epoll\n", ev.data.fd );
     }
+    // add the transmit, response window and trace timers to epoll
+    if( -1 == shared_watch( epfd, args.verbosity ) ) {
+        exit( EXIT_FAILURE );
+    }
     // clear epoll event to re-use
     memset( &ev, 0, sizeof( ev ) );
     int nfds = 0;
+
+    shared_realtime( &args.shared, args.verbosity );
+
     if( args.verbosity > 0 ) {
         puts( "starting epoll loop" );
     }
@@ -158,10 +183,11 @@ int main( int argc, char ** argv ) {
                             " and it triggered without EPOLLIN\n" );
                     continue;
                 } else if ( sfd == ev.data.fd ) {
+                    R2_TRACE( R2_TRACE_WAKE );
                     sio_handle( sio, output_channel, lio );
                 } else if ( lfd == ev.data.fd ) {
                     lcm_handle( lio );
-                } else {
+                } else if ( !shared_handle( lio, ev.data.fd ) ) {
                     fprintf( stderr, "unexpected fd %d\n", ev.data.fd );
                     loop = 0;
                 }
@@ -172,6 +198,7 @@ int main( int argc, char ** argv ) {
     }
 
     close( epfd );
+    if( -1 != latency.fd ) close( latency.fd );
     lcm_destroy( lio );
     if( EOF == fclose( sio ) ) {
         fprintf( stderr, "fclose(): %s\n", strerror( ferror( sio ) ) );
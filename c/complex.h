@@ -22,11 +22,15 @@ struct arguments {
     speed_t baudrate;
     char terminator;
     char initiator;
+    struct shared_arguments shared;
 };
 
 static error_t parse_opt( int key, char *arg, struct argp_state *state ) {
     struct arguments *args = state->input;
     switch( key ){
+        case ARGP_KEY_INIT:
+            state->child_inputs[0] = &(args->shared);
+            break;
         case 'q':
             args->verbosity = -1;
             break;
@@ -58,7 +62,8 @@ static error_t parse_opt( int key, char *arg, struct argp_state *state ) {
     return 0;
 }
 
-static struct argp argp = { options, parse_opt, args_doc, doc };
+static struct argp argp = { options, parse_opt, args_doc, doc,
+    shared_children };
 
 struct arguments args;
 
@@ -71,4 +76,9 @@ struct termios tio = {
         .c_cc[VTIME] = 1,
 };
 
+// allocated up front, so that nothing is allocated per message
+char sio_buffer[MAX_LENGTH];
+uint8_t lcm_buffer[RAW_BYTES_ENCODED_SIZE( MAX_LENGTH )];
+char stdout_buffer[BUFSIZ];
+
 #endif // _COMPLEX_H
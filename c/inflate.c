@@ -0,0 +1,128 @@
+#include "config.h"
+
+// serial-lcm-inflate: for the far end of a thin link, republishes the
+// compressed frames from a bridge as raw_bytes_t on the original channels;
+// it opens no serial port, so it needs raw_bytes_publish and zbytes.h but
+// none of bridges.h
+
+#include <argp.h>
+
+#include "publish.h"
+// #includes: lcm.h, raw_bytes_t.h, r2_trace.h, zbytes.h
+
+const char *argp_program_version = PACKAGE_STRING;
+
+const char *argp_program_bug_address = PACKAGE_BUGREPORT;
+
+#define MAX_CHANNELS 64
+
+static char doc[] = "serial-lcm-inflate -- republish compressed serial frames"
+    " on their original LCM channels";
+static char args_doc[] = "channel...";
+
+static struct argp_option options[] = {
+    { "verbose", 'v', 0, 0, "say more" },
+    { "quiet", 'q', 0, 0, "say less" },
+    { "dictionary", 'd', "file", 0,
+        "zstd dictionary the frames may be compressed with (repeatable)" },
+    { 0 }
+};
+
+struct arguments {
+    int8_t verbosity;
+    char * dictionaries[ZBYTES_MAX_DICTIONARIES];
+    int ndictionaries;
+    char * channels[MAX_CHANNELS];
+    int nchannels;
+};
+
+static error_t parse_opt( int key, char *arg, struct argp_state *state ) {
+    struct arguments *args = state->input;
+    switch( key ){
+        case 'q':
+            args->verbosity = -1;
+            break;
+        case 'v':
+            args->verbosity += 1;
+            break;
+        case 'd':
+            if( ZBYTES_MAX_DICTIONARIES == args->ndictionaries ) {
+                argp_error( state, "at most %d dictionaries",
+                        ZBYTES_MAX_DICTIONARIES );
+            }
+            args->dictionaries[args->ndictionaries++] = arg;
+            break;
+        case ARGP_KEY_ARG:
+            if( MAX_CHANNELS == args->nchannels ) {
+                argp_error( state, "at most %d channels", MAX_CHANNELS );
+            }
+            args->channels[args->nchannels++] = arg;
+            break;
+        case ARGP_KEY_END:
+            if( state->arg_num < 1 ) argp_usage( state );
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+struct arguments args;
+
+uint8_t lcm_buffer[RAW_BYTES_ENCODED_SIZE( ZBYTES_MAX_LENGTH )];
+
+
+// republish on the channel without ZBYTES_SUFFIX
+static void inflated( const char * channel, const raw_bytes_t * msg,
+        void * user ) {
+    char original[ZBYTES_MAX_CHANNEL];
+    size_t length = strlen( channel ) - strlen( ZBYTES_SUFFIX );
+    if( length >= sizeof( original ) ) length = sizeof( original ) - 1;
+    memcpy( original, channel, length );
+    original[length] = '\0';
+    if( args.verbosity > 1 ) {
+        printf( "%s: %d bytes\n", original, msg->length );
+    }
+    raw_bytes_publish( (lcm_t *)user, original, msg, lcm_buffer,
+            sizeof( lcm_buffer ) );
+}
+
+
+int main( int argc, char ** argv ) {
+    args.verbosity = 0;
+    args.ndictionaries = 0;
+    args.nchannels = 0;
+    argp_parse( &argp, argc, argv, 0, 0, &args );
+
+    lcm_t * lio = lcm_create( NULL );
+    if( NULL == lio ) {
+        fputs( "could not create LCM instance\n", stderr );
+        exit( EXIT_FAILURE );
+    }
+
+    struct zbytes_reader * reader = zbytes_reader_open( &inflated, lio );
+    for( int k = 0; k < args.ndictionaries; k++ ) {
+        zbytes_reader_add_dictionary( reader, args.dictionaries[k] );
+        if( args.verbosity > 0 ) {
+            printf( "dictionary %u: %s\n", reader->ids[k],
+                    args.dictionaries[k] );
+        }
+    }
+
+    char compressed[MAX_CHANNELS][ZBYTES_MAX_CHANNEL];
+    for( int k = 0; k < args.nchannels; k++ ) {
+        snprintf( compressed[k], ZBYTES_MAX_CHANNEL, "%s%s", args.channels[k],
+                ZBYTES_SUFFIX );
+        zbytes_subscribe( lio, compressed[k], reader );
+        if( args.verbosity >= 0 ) {
+            printf( "inflating %s to %s\n", compressed[k], args.channels[k] );
+        }
+    }
+
+    while( 0 == lcm_handle( lio ) );
+
+    lcm_destroy( lio );
+    exit( EXIT_SUCCESS );
+}
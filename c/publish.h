@@ -0,0 +1,46 @@
+// publish.h
+// Publishing raw_bytes_t without allocating, for every program that
+// publishes frames: the bridges (through bridges.h) and serial-lcm-inflate.
+// With zstd, each frame published is also handed to the compressor, if one
+// is open.
+
+#ifndef _PUBLISH_H
+#define _PUBLISH_H
+
+#include <lcm/lcm.h>
+#include "raw_bytes_t.h"
+
+#include "r2_trace.h"
+
+#ifdef HAVE_ZSTD
+#include "zbytes.h"
+#endif
+
+#ifdef HAVE_ZSTD
+// compresses everything published, NULL unless the bridge was asked to
+struct zbytes_worker * zbytes = NULL;
+#endif
+
+// encoded size of a raw_bytes_t: fingerprint, utime, length, then the data
+#define RAW_BYTES_ENCODED_SIZE( length ) ( 8 + 8 + 4 + ( length ) )
+
+// like raw_bytes_t_publish, but encodes into a buffer the caller allocated
+// up front, instead of allocating one for every message
+static int raw_bytes_publish( lcm_t * lio, const char * channel,
+        const raw_bytes_t * msg, uint8_t * buf, int size ) {
+    int n = raw_bytes_t_encode( buf, 0, size, msg );
+    if( n < 0 ) {
+        fprintf( stderr, "could not encode %d-byte message\n", msg->length );
+        return n;
+    }
+    R2_TRACE( R2_TRACE_ENCODED );
+    n = lcm_publish( lio, channel, buf, n );
+    R2_TRACE( R2_TRACE_PUBLISHED );
+    R2_TRACE_COMMIT();
+#ifdef HAVE_ZSTD
+    if( zbytes ) zbytes_post( zbytes, channel, msg );
+#endif
+    return n;
+}
+
+#endif // _PUBLISH_H
@@ -0,0 +1,327 @@
+// r2_demux.h
+// Route frames on a multi-drop bus to per-address channels, and take turns
+// writing to it
+//
+// Frames are routed by an address byte at a fixed offset in the frame, or by
+// the address field of an NMEA sentence: the longest of its first 2 to 5
+// characters that has a route (e.g., `GPGGA`, the proprietary `PGRM`, or
+// just the talker `GP`). Both lookups go through tables filled in at
+// startup: 256 entries for address bytes, and a small open-addressed hash
+// for sentence IDs.
+// Route 0 is the default, for frames that match no other route.
+//
+// Writes are queued per route. Only one route holds the bus at a time: it
+// writes, then keeps the bus until a frame comes back on the same route or
+// the response window expires, and the next route with a queued write (round
+// robin) gets its turn. With no response window, writes go out as they come.
+// Writes go through a transmit queue (r2_txq.h) if the demux has one (see
+// r2_demux_pace), in which case the response window starts once the queue
+// has sent the write, rather than when it was queued behind the gaps.
+
+#ifndef _R2_DEMUX_H_
+#define _R2_DEMUX_H_
+
+#define R2_DEMUX_MAX_ROUTES 33 // RS-485 allows 32 unit loads, plus the default
+#define R2_DEMUX_MAX_LENGTH 4096 // bytes per queued write
+#define R2_DEMUX_QUEUE 4 // queued writes per route, must be a power of two
+#define R2_DEMUX_QUEUE_MASK ( R2_DEMUX_QUEUE - 1 )
+#define R2_DEMUX_TABLE_SIZE 128 // NMEA hash slots, power of two > 2 * routes
+#define R2_DEMUX_TABLE_MASK ( R2_DEMUX_TABLE_SIZE - 1 )
+#define R2_DEMUX_CHANNEL_LENGTH 32
+#define R2_DEMUX_NMEA_ID_LENGTH 5 // talker (2) and sentence (3)
+
+#include <inttypes.h> // for uint8_t, uint64_t
+#include <stdio.h> // for snprintf, fprintf
+#include <stdlib.h> // for calloc, strtoul
+#include <string.h> // for memcpy, strlen
+#include <sys/timerfd.h> // for timerfd_create, timerfd_settime
+#include <unistd.h> // for read, write
+
+#include "r2_txq.h"
+
+enum r2_demux_mode {
+    R2_DEMUX_NONE, // everything on one channel, writes go out as they come
+    R2_DEMUX_ADDRESS, // address byte at an offset in the frame
+    R2_DEMUX_NMEA // NMEA sentence ID (or talker ID) after `$` or `!`
+};
+
+struct r2_demux_write {
+    int64_t utime;
+    size_t length;
+    uint8_t data[R2_DEMUX_MAX_LENGTH];
+};
+
+struct r2_demux;
+
+struct r2_demux_route {
+    struct r2_demux * demux;
+    char output[R2_DEMUX_CHANNEL_LENGTH]; // channel for frames read
+    char input[R2_DEMUX_CHANNEL_LENGTH]; // channel for frames to write
+    struct r2_demux_write queue[R2_DEMUX_QUEUE];
+    unsigned int head; // next write to queue
+    unsigned int tail; // next write to send
+};
+
+struct r2_demux_slot {
+    uint64_t key; // packed sentence ID, 0 for an empty slot
+    int route;
+};
+
+struct r2_demux {
+    enum r2_demux_mode mode;
+    size_t offset; // of the address byte, or of the `$` or `!`
+    int sfd; // the bus
+    struct r2_txq * txq; // paces writes to the bus, NULL to write directly
+    uint64_t awaiting; // txq frame number of the write holding the bus
+    int tfd; // response window timer, -1 if there is no window
+    int64_t window; // microseconds
+    int nroutes;
+    int granted; // route holding the bus, -1 if it is free
+    int last; // route that held the bus last, for round robin
+    uint8_t addresses[256]; // address byte -> route
+    struct r2_demux_slot ids[R2_DEMUX_TABLE_SIZE]; // sentence ID -> route
+    unsigned int lengths; // bit n set if an n-character sentence ID is routed
+    struct r2_demux_route routes[R2_DEMUX_MAX_ROUTES];
+};
+
+
+// pack up to R2_DEMUX_NMEA_ID_LENGTH characters of a sentence ID, stopping at
+// the first comma or `*`, or return 0 if there is none
+static inline uint64_t r2_demux_nmea_key( const uint8_t * id, size_t length ) {
+    uint64_t key = 0;
+    size_t k = 0;
+    for( ; k < length && k < R2_DEMUX_NMEA_ID_LENGTH; k++ ) {
+        if( ',' == id[k] || '*' == id[k] ) break;
+        key = ( key << 8 ) | id[k];
+    }
+    return key | ( (uint64_t)k << 56 );
+}
+
+
+static inline unsigned int r2_demux_nmea_hash( uint64_t key ) {
+    return (unsigned int)( ( key * 0x9e3779b97f4a7c15ULL ) >> 57 )
+        & R2_DEMUX_TABLE_MASK;
+}
+
+
+static inline int r2_demux_nmea_find( const struct r2_demux * d,
+        uint64_t key ) {
+    for( unsigned int h = r2_demux_nmea_hash( key ); d->ids[h].key;
+            h = ( h + 1 ) & R2_DEMUX_TABLE_MASK ) {
+        if( key == d->ids[h].key ) return d->ids[h].route;
+    }
+    return 0;
+}
+
+
+// route 0 publishes on output and subscribes to input; routes added later
+// append their key to each
+struct r2_demux * r2_demux_open( enum r2_demux_mode mode, size_t offset,
+        int sfd, int64_t window, const char * output, const char * input ) {
+    struct r2_demux * d = (struct r2_demux *)calloc( 1, sizeof( struct r2_demux ) );
+    if( NULL == d ) {
+        perror( "calloc()" );
+        fputs( "could not allocate demux tables\n", stderr );
+        exit( EXIT_FAILURE );
+    }
+    d->mode = mode;
+    d->offset = offset;
+    d->sfd = sfd;
+    d->tfd = -1;
+    d->window = window;
+    d->granted = -1;
+    d->nroutes = 1;
+    d->routes[0].demux = d;
+    snprintf( d->routes[0].output, R2_DEMUX_CHANNEL_LENGTH, "%s", output );
+    snprintf( d->routes[0].input, R2_DEMUX_CHANNEL_LENGTH, "%s", input );
+    if( window > 0 ) {
+        d->tfd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK );
+        if( -1 == d->tfd ) {
+            perror( "timerfd_create()" );
+            fputs( "could not create response window timer\n", stderr );
+            exit( EXIT_FAILURE );
+        }
+    }
+    return d;
+}
+
+
+// add a route for key: an address byte in hex (e.g., `1f`), or an NMEA
+// sentence or talker ID (e.g., `GPGGA` or `GP`); returns the route, or -1
+int r2_demux_add( struct r2_demux * d, const char * key ) {
+    if( R2_DEMUX_MAX_ROUTES == d->nroutes ) {
+        fprintf( stderr, "too many routes, at most %d\n",
+                R2_DEMUX_MAX_ROUTES - 1 );
+        return -1;
+    }
+    int r = d->nroutes;
+    if( R2_DEMUX_ADDRESS == d->mode ) {
+        char * end = NULL;
+        unsigned long address = strtoul( key, &end, 16 );
+        if( '\0' == *key || '\0' != *end || address > 0xff ) {
+            fprintf( stderr, "address %s is not one hex byte\n", key );
+            return -1;
+        }
+        if( d->addresses[address] ) {
+            fprintf( stderr, "address %s is already routed\n", key );
+            return -1;
+        }
+        d->addresses[address] = r;
+    } else if( R2_DEMUX_NMEA == d->mode ) {
+        size_t length = strlen( key );
+        if( length < 2 || length > R2_DEMUX_NMEA_ID_LENGTH
+                || strpbrk( key, ",*" ) ) {
+            fprintf( stderr, "%s is not an NMEA talker or sentence ID\n", key );
+            return -1;
+        }
+        uint64_t packed = r2_demux_nmea_key( (const uint8_t *)key, length );
+        if( r2_demux_nmea_find( d, packed ) ) {
+            fprintf( stderr, "sentence ID %s is already routed\n", key );
+            return -1;
+        }
+        unsigned int h = r2_demux_nmea_hash( packed );
+        while( d->ids[h].key ) h = ( h + 1 ) & R2_DEMUX_TABLE_MASK;
+        d->ids[h].key = packed;
+        d->ids[h].route = r;
+        d->lengths |= 1u << length;
+    } else {
+        fputs( "routes need an address offset or NMEA sentence IDs\n", stderr );
+        return -1;
+    }
+    struct r2_demux_route * route = &(d->routes[r]);
+    route->demux = d;
+    snprintf( route->output, R2_DEMUX_CHANNEL_LENGTH, "%s%s",
+            d->routes[0].output, key );
+    snprintf( route->input, R2_DEMUX_CHANNEL_LENGTH, "%s%s",
+            d->routes[0].input, key );
+    d->nroutes++;
+    return r;
+}
+
+
+// the route for a frame: for NMEA, the longest prefix of its sentence ID that
+// has a route
+static inline int r2_demux_lookup( const struct r2_demux * d,
+        const uint8_t * data, size_t length ) {
+    if( d->offset >= length ) return 0;
+    if( R2_DEMUX_ADDRESS == d->mode ) {
+        return d->addresses[data[d->offset]];
+    } else if( R2_DEMUX_NMEA == d->mode ) {
+        const uint8_t * id = data + d->offset;
+        if( '$' != *id && '!' != *id ) return 0;
+        id++;
+        length -= d->offset + 1;
+        for( size_t k = R2_DEMUX_NMEA_ID_LENGTH; k >= 2; k-- ) {
+            if( k > length || !( d->lengths & ( 1u << k ) ) ) continue;
+            int r = r2_demux_nmea_find( d, r2_demux_nmea_key( id, k ) );
+            if( r ) return r;
+        }
+        return 0;
+    }
+    return 0;
+}
+
+
+static void r2_demux_arm( struct r2_demux * d, int64_t usec ) {
+    struct itimerspec t = { { 0 } };
+    t.it_value.tv_sec = usec / 1000000;
+    t.it_value.tv_nsec = ( usec % 1000000 ) * 1000;
+    timerfd_settime( d->tfd, 0, &t, NULL );
+}
+
+
+// free the bus, and give it to the next route with a queued write
+static void r2_demux_next( struct r2_demux * d ) {
+    d->granted = -1;
+    for( int k = 1; k <= d->nroutes; k++ ) {
+        int r = ( d->last + k ) % d->nroutes;
+        struct r2_demux_route * route = &(d->routes[r]);
+        if( route->head == route->tail ) continue;
+        struct r2_demux_write * w = &(route->queue[route->tail & R2_DEMUX_QUEUE_MASK]);
+        int written = 1;
+        if( d->txq ) {
+            written = ( 0 == r2_txq_push( d->txq, w->utime, w->data,
+                        w->length ) );
+            d->awaiting = d->txq->queued;
+        } else if( -1 == write( d->sfd, w->data, w->length ) ) {
+            perror( "write()" );
+        }
+        route->tail++;
+        d->last = r;
+        if( d->window > 0 && written ) {
+            d->granted = r;
+            // a queued write starts the window once it is sent (r2_demux_sent)
+            if( NULL == d->txq ) r2_demux_arm( d, d->window );
+            return;
+        }
+        k = 0; // no window, so keep going until every queue is empty
+    }
+}
+
+
+// the transmit queue's sent handler: start the response window of the write
+// holding the bus, now that it is on the wire
+static void r2_demux_sent( void * user, uint64_t frame ) {
+    struct r2_demux * d = (struct r2_demux *)user;
+    if( -1 != d->granted && frame == d->awaiting ) {
+        r2_demux_arm( d, d->window );
+    }
+}
+
+
+// write through a transmit queue, which tells the demux when each write is
+// sent
+void r2_demux_pace( struct r2_demux * d, struct r2_txq * q ) {
+    d->txq = q;
+    q->sent_handler = &r2_demux_sent;
+    q->user = d;
+}
+
+
+// queue a write on a route, and send it now if the bus is free
+void r2_demux_write( struct r2_demux_route * route, int64_t utime,
+        const uint8_t * data, size_t length ) {
+    struct r2_demux * d = route->demux;
+    if( R2_DEMUX_QUEUE == route->head - route->tail ) {
+        fprintf( stderr, "%d writes already queued on %s, dropping one\n",
+                R2_DEMUX_QUEUE, route->input );
+        return;
+    }
+    if( length > R2_DEMUX_MAX_LENGTH ) {
+        fprintf( stderr, "%zu bytes is too long to queue on %s\n", length,
+                route->input );
+        return;
+    }
+    struct r2_demux_write * w = &(route->queue[route->head & R2_DEMUX_QUEUE_MASK]);
+    memcpy( w->data, data, length );
+    w->utime = utime;
+    w->length = length;
+    route->head++;
+    if( -1 == d->granted ) r2_demux_next( d );
+}
+
+
+// route a frame that was read, ending the turn of the route it answers;
+// returns the channel to publish it on
+const char * r2_demux_frame( struct r2_demux * d, const uint8_t * data,
+        size_t length ) {
+    int r = r2_demux_lookup( d, data, length );
+    if( r == d->granted ) {
+        r2_demux_arm( d, 0 );
+        r2_demux_next( d );
+    }
+    return d->routes[r].output;
+}
+
+
+// call when the response window timer is readable
+void r2_demux_timeout( struct r2_demux * d ) {
+    uint64_t expirations;
+    if( -1 == read( d->tfd, &expirations, sizeof( expirations ) ) ) return;
+    if( -1 != d->granted ) {
+        fprintf( stderr, "no response on %s\n", d->routes[d->granted].output );
+        r2_demux_next( d );
+    }
+}
+
+#endif // _R2_DEMUX_H_
@@ -0,0 +1,65 @@
+// r2_rt.h
+// Simple functions for real-time scheduling and locked memory
+
+#ifndef _R2_RT_H_
+#define _R2_RT_H_
+
+// stack to fault in before the loop starts
+#define R2_RT_STACK_PREFAULT ( 256 * 1024 )
+#define R2_RT_PAGE_SIZE 4096
+
+#include <malloc.h> // for mallopt
+#include <pthread.h> // for pthread_setschedparam, pthread_setaffinity_np
+#include <sched.h> // for SCHED_FIFO, cpu_set_t
+#include <string.h> // for strerror
+#include <sys/mman.h> // for mlockall
+
+
+void r2_rt_prefault_stack( void ) {
+    volatile char stack[R2_RT_STACK_PREFAULT];
+    for( size_t k = 0; k < sizeof( stack ); k += R2_RT_PAGE_SIZE ) {
+        stack[k] = 0;
+    }
+}
+
+
+// lock current and future pages, and keep the heap from giving any back
+void r2_rt_lock_memory( void ) {
+    mallopt( M_TRIM_THRESHOLD, -1 );
+    mallopt( M_MMAP_MAX, 0 );
+    if( -1 == mlockall( MCL_CURRENT | MCL_FUTURE ) ) {
+        perror( "mlockall()" );
+        fputs( "could not lock memory (check RLIMIT_MEMLOCK)\n", stderr );
+        exit( EXIT_FAILURE );
+    }
+    r2_rt_prefault_stack();
+}
+
+
+// SCHED_FIFO at priority (if > 0), pinned to cpu (if >= 0)
+void r2_rt_schedule( pthread_t thread, int priority, int cpu ) {
+    int error = 0;
+    if( priority > 0 ) {
+        struct sched_param param = { 0 };
+        param.sched_priority = priority;
+        error = pthread_setschedparam( thread, SCHED_FIFO, &param );
+        if( error ) {
+            fprintf( stderr, "pthread_setschedparam(): %s\n", strerror( error ) );
+            fprintf( stderr, "could not set SCHED_FIFO priority %d\n", priority );
+            exit( EXIT_FAILURE );
+        }
+    }
+    if( cpu >= 0 ) {
+        cpu_set_t cpus;
+        CPU_ZERO( &cpus );
+        CPU_SET( cpu, &cpus );
+        error = pthread_setaffinity_np( thread, sizeof( cpus ), &cpus );
+        if( error ) {
+            fprintf( stderr, "pthread_setaffinity_np(): %s\n", strerror( error ) );
+            fprintf( stderr, "could not pin thread to cpu %d\n", cpu );
+            exit( EXIT_FAILURE );
+        }
+    }
+}
+
+#endif // _R2_RT_H_
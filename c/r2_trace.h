@@ -0,0 +1,167 @@
+// r2_trace.h
+// Per-stage latency tracing into a lock-free, per-thread ring
+//
+// Each thread that traces owns a ring (see r2_trace_open). The thread stamps
+// the monotonic time at each stage of a frame, and commits the record once
+// the frame is published; a consumer (the same thread or another one) drains
+// the ring into a summary. With no ring open, each stamp costs a test of a
+// thread-local pointer.
+//
+// If <sys/sdt.h> is available, each stamp is also a USDT probe,
+// `serial_lcm_bridge:stage`, with the stage number as its argument, e.g.:
+//
+//     bpftrace -e 'usdt:./serial-lcm-bridge:serial_lcm_bridge:stage
+//             { @[arg0] = count(); }'
+
+#ifndef _R2_TRACE_H_
+#define _R2_TRACE_H_
+
+#define R2_TRACE_RING_SIZE 1024 // records, must be a power of two
+#define R2_TRACE_RING_MASK ( R2_TRACE_RING_SIZE - 1 )
+
+#include <inttypes.h> // for int64_t, INT64_MAX
+#include <stdio.h> // for perror
+#include <stdlib.h> // for calloc
+#include <string.h> // for memset
+#include <sys/timerfd.h> // for timerfd_create
+#include <time.h> // for timespec, clock_gettime
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define R2_TRACE_PROBE( s ) DTRACE_PROBE1( serial_lcm_bridge, stage, s )
+#else
+#define R2_TRACE_PROBE( s )
+#endif
+
+enum r2_trace_stage {
+    R2_TRACE_WAKE, // epoll said the serial port is readable
+    R2_TRACE_READ, // first byte of the frame read
+    R2_TRACE_FRAMED, // frame complete
+    R2_TRACE_ENCODED, // frame encoded for LCM
+    R2_TRACE_PUBLISHED, // lcm_publish returned
+    R2_TRACE_STAGES
+};
+
+const char * R2_TRACE_STAGE_NAMES[R2_TRACE_STAGES] = {
+    "wake", "read", "framed", "encoded", "published"
+};
+
+struct r2_trace_record {
+    int64_t t[R2_TRACE_STAGES]; // nanoseconds, CLOCK_MONOTONIC
+};
+
+struct r2_trace_ring {
+    struct r2_trace_record records[R2_TRACE_RING_SIZE];
+    struct r2_trace_record current; // being stamped by the producer
+    int64_t published; // when the last record committed was published
+    uint64_t head; // written only by the producer
+    uint64_t tail; // written only by the consumer
+    uint64_t dropped;
+};
+
+// time spent reaching each stage from the one before it
+struct r2_trace_summary {
+    int32_t count;
+    int32_t dropped;
+    int64_t min[R2_TRACE_STAGES];
+    int64_t mean[R2_TRACE_STAGES];
+    int64_t max[R2_TRACE_STAGES];
+};
+
+// the calling thread's ring, or NULL when it is not tracing
+__thread struct r2_trace_ring * r2_trace = NULL;
+
+#define R2_TRACE( stage ) do { \
+    R2_TRACE_PROBE( stage ); \
+    if( r2_trace ) r2_trace_stamp( stage ); \
+} while( 0 )
+
+#define R2_TRACE_COMMIT() do { \
+    if( r2_trace ) r2_trace_commit(); \
+} while( 0 )
+
+
+// start tracing on the calling thread
+struct r2_trace_ring * r2_trace_open( void ) {
+    r2_trace = (struct r2_trace_ring *)calloc( 1, sizeof( struct r2_trace_ring ) );
+    if( NULL == r2_trace ) {
+        perror( "calloc()" );
+        fputs( "could not allocate trace ring\n", stderr );
+        exit( EXIT_FAILURE );
+    }
+    return r2_trace;
+}
+
+
+static inline void r2_trace_stamp( enum r2_trace_stage stage ) {
+    struct timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    r2_trace->current.t[stage] = (int64_t)( t.tv_sec ) * 1000000000 + t.tv_nsec;
+}
+
+
+// copy the current record into the ring, or count it as dropped if full,
+// then clear it so no stage leaks into the next record
+static inline void r2_trace_commit( void ) {
+    struct r2_trace_ring * ring = r2_trace;
+    uint64_t head = ring->head;
+    ring->published = ring->current.t[R2_TRACE_PUBLISHED];
+    if( R2_TRACE_RING_SIZE
+            == head - __atomic_load_n( &(ring->tail), __ATOMIC_ACQUIRE ) ) {
+        __atomic_add_fetch( &(ring->dropped), 1, __ATOMIC_RELAXED );
+    } else {
+        ring->records[head & R2_TRACE_RING_MASK] = ring->current;
+        __atomic_store_n( &(ring->head), head + 1, __ATOMIC_RELEASE );
+    }
+    memset( &(ring->current), 0, sizeof( ring->current ) );
+}
+
+
+// drain the ring into a summary
+void r2_trace_summarize( struct r2_trace_ring * ring,
+        struct r2_trace_summary * summary ) {
+    int64_t sum[R2_TRACE_STAGES] = { 0 };
+    memset( summary, 0, sizeof( *summary ) );
+    for( int s = 1; s < R2_TRACE_STAGES; s++ ) summary->min[s] = INT64_MAX;
+
+    uint64_t head = __atomic_load_n( &(ring->head), __ATOMIC_ACQUIRE );
+    uint64_t tail = ring->tail;
+    for( ; tail != head; tail++ ) {
+        const struct r2_trace_record * r = &(ring->records[tail & R2_TRACE_RING_MASK]);
+        for( int s = 1; s < R2_TRACE_STAGES; s++ ) {
+            int64_t dt = r->t[s] - r->t[s - 1];
+            if( dt < summary->min[s] ) summary->min[s] = dt;
+            if( dt > summary->max[s] ) summary->max[s] = dt;
+            sum[s] += dt;
+        }
+        summary->count++;
+    }
+    __atomic_store_n( &(ring->tail), tail, __ATOMIC_RELEASE );
+    summary->dropped = __atomic_exchange_n( &(ring->dropped), 0, __ATOMIC_RELAXED );
+
+    for( int s = 1; s < R2_TRACE_STAGES; s++ ) {
+        if( summary->count ) {
+            summary->mean[s] = sum[s] / summary->count;
+        } else {
+            summary->min[s] = 0;
+        }
+    }
+}
+
+
+// a timerfd that expires every period_usec, for epoll
+int r2_trace_timer( int64_t period_usec ) {
+    struct itimerspec period = { { 0 } };
+    period.it_interval.tv_sec = period_usec / 1000000;
+    period.it_interval.tv_nsec = ( period_usec % 1000000 ) * 1000;
+    period.it_value = period.it_interval;
+    int tfd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK );
+    if( -1 == tfd || -1 == timerfd_settime( tfd, 0, &period, NULL ) ) {
+        perror( "timerfd" );
+        fputs( "could not create trace timer\n", stderr );
+        exit( EXIT_FAILURE );
+    }
+    return tfd;
+}
+
+#endif // _R2_TRACE_H_
@@ -0,0 +1,326 @@
+// r2_txq.h
+// Timed transmit queue for a serial port: gaps between frames and between
+// characters, half-duplex direction control, and transmit at a given time
+//
+// Frames wait in a queue ordered by when they are due. One frame goes out at
+// a time, and the next starts no sooner than the frame gap after the last
+// byte of the one before has left the wire. With a character gap, each byte
+// is written on its own, a character time plus the gap after the one before.
+//
+// For half-duplex (e.g., RS-485) links, RTS or DTR is asserted before a frame
+// and dropped once the transmitter is empty (TIOCSER_TEMT), so the line turns
+// around as soon as it can. Ports without TIOCSERGETLSR (USB adapters, ptys)
+// fall back to polling the driver's output queue (TIOCOUTQ) until it is
+// empty. Either way the queue re-arms its timer a character time later
+// rather than waiting in the driver, so the caller's loop never blocks.
+//
+// Frames are numbered from 1 in the order they are queued. Once the last
+// byte of a frame has left the transmitter, the queue calls its sent
+// handler, if it has one, with that number (e.g., so r2_demux.h can start a
+// response window then, rather than when the frame was queued).
+//
+// The gaps, and the waits for the transmitter to drain, are timed on
+// CLOCK_MONOTONIC, so a step of the wall clock (e.g., NTP or PPS setting it)
+// cannot stretch or cut them short. Scheduled frames are due at a utime,
+// microseconds since the Unix epoch, which is converted to CLOCK_MONOTONIC
+// when the frame is queued. The queue keeps one timerfd (absolute,
+// CLOCK_MONOTONIC) armed for its next step; call r2_txq_service whenever it
+// is readable.
+
+#ifndef _R2_TXQ_H_
+#define _R2_TXQ_H_
+
+#define R2_TXQ_SLOTS 16 // frames waiting to be sent
+#define R2_TXQ_MAX_LENGTH 4096 // bytes per frame
+
+#include <errno.h> // for errno
+#include <inttypes.h> // for int64_t
+#include <stdio.h> // for perror, fprintf
+#include <stdlib.h> // for calloc
+#include <string.h> // for memcpy
+#include <sys/ioctl.h> // for TIOCMBIS, TIOCSERGETLSR, TIOCSER_TEMT, TIOCOUTQ
+#include <sys/timerfd.h> // for timerfd_create, timerfd_settime
+#include <termios.h> // for cfgetospeed
+#include <time.h> // for clock_gettime
+#include <unistd.h> // for write
+
+#include "r2_epoch.h"
+
+enum r2_txq_direction {
+    R2_TXQ_FULL_DUPLEX, // leave the modem lines alone
+    R2_TXQ_RTS, // assert RTS while sending
+    R2_TXQ_DTR // assert DTR while sending
+};
+
+enum r2_txq_state {
+    R2_TXQ_IDLE, // waiting for a frame to be due
+    R2_TXQ_SENDING, // writing a frame, a character at a time if there is a gap
+    R2_TXQ_DRAINING // waiting for the last byte to leave the transmitter
+};
+
+// called with the number of a frame once it has been sent
+typedef void (*r2_txq_handler_t)( void * user, uint64_t frame );
+
+struct r2_txq_frame {
+    uint64_t number; // in the order queued, from 1
+    int64_t due; // CLOCK_MONOTONIC microseconds to send at, 0 for now
+    size_t length;
+    uint8_t data[R2_TXQ_MAX_LENGTH];
+};
+
+struct r2_txq {
+    int sfd;
+    int tfd;
+    int64_t char_usec; // time to send one character at the port's settings
+    int64_t frame_gap;
+    int64_t char_gap;
+    enum r2_txq_direction direction;
+    int scheduled; // honour utime, instead of sending as soon as possible
+    int lsr; // 0 once TIOCSERGETLSR turns out to be unsupported
+    enum r2_txq_state state;
+    int64_t ready; // earliest start of the next frame, CLOCK_MONOTONIC
+    struct r2_txq_frame * current;
+    size_t sent;
+    int n;
+    struct r2_txq_frame * order[R2_TXQ_SLOTS]; // queued frames, by due time
+    struct r2_txq_frame * free[R2_TXQ_SLOTS];
+    int nfree;
+    uint64_t queued; // frames queued so far, the number of the last one
+    r2_txq_handler_t sent_handler; // NULL for none
+    void * user;
+    struct r2_txq_frame slots[R2_TXQ_SLOTS];
+};
+
+
+// microseconds on CLOCK_MONOTONIC, which the queue keeps all its times in
+static inline int64_t r2_txq_usec_now( void ) {
+    struct timespec t;
+    clock_gettime( CLOCK_MONOTONIC, &t );
+    return (int64_t)( t.tv_sec ) * 1000000 + t.tv_nsec / 1000;
+}
+
+
+static int r2_txq_baudrate( speed_t speed ) {
+    switch( speed ) {
+        case B1200: return 1200;
+        case B2400: return 2400;
+        case B4800: return 4800;
+        case B9600: return 9600;
+        case B19200: return 19200;
+        case B38400: return 38400;
+        case B57600: return 57600;
+        case B115200: return 115200;
+        case B230400: return 230400;
+        default: return 9600;
+    }
+}
+
+
+// microseconds on the wire per character: start, data, parity and stop bits
+int64_t r2_txq_char_usec( const struct termios * tio ) {
+    int bits = 1 + 1;
+    switch( tio->c_cflag & CSIZE ) {
+        case CS5: bits += 5; break;
+        case CS6: bits += 6; break;
+        case CS7: bits += 7; break;
+        default: bits += 8; break;
+    }
+    if( tio->c_cflag & PARENB ) bits += 1;
+    if( tio->c_cflag & CSTOPB ) bits += 1;
+    int baudrate = r2_txq_baudrate( cfgetospeed( tio ) );
+    return ( bits * 1000000L + baudrate - 1 ) / baudrate;
+}
+
+
+struct r2_txq * r2_txq_open( int sfd, const struct termios * tio,
+        int64_t frame_gap, int64_t char_gap,
+        enum r2_txq_direction direction, int scheduled ) {
+    struct r2_txq * q = (struct r2_txq *)calloc( 1, sizeof( struct r2_txq ) );
+    if( NULL == q ) {
+        perror( "calloc()" );
+        fputs( "could not allocate transmit queue\n", stderr );
+        exit( EXIT_FAILURE );
+    }
+    q->sfd = sfd;
+    q->char_usec = r2_txq_char_usec( tio );
+    q->frame_gap = frame_gap;
+    q->char_gap = char_gap;
+    q->direction = direction;
+    q->scheduled = scheduled;
+    q->lsr = 1;
+    q->state = R2_TXQ_IDLE;
+    for( int k = 0; k < R2_TXQ_SLOTS; k++ ) q->free[k] = &(q->slots[k]);
+    q->nfree = R2_TXQ_SLOTS;
+    q->tfd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK );
+    if( -1 == q->tfd ) {
+        perror( "timerfd_create()" );
+        fputs( "could not create transmit timer\n", stderr );
+        exit( EXIT_FAILURE );
+    }
+    return q;
+}
+
+
+// wake at usec on CLOCK_MONOTONIC (or never, if usec is 0)
+static void r2_txq_arm( struct r2_txq * q, int64_t usec ) {
+    struct itimerspec t = { { 0 } };
+    t.it_value.tv_sec = usec / 1000000;
+    t.it_value.tv_nsec = ( usec % 1000000 ) * 1000;
+    if( -1 == timerfd_settime( q->tfd, TFD_TIMER_ABSTIME, &t, NULL ) ) {
+        perror( "timerfd_settime()" );
+    }
+}
+
+
+static void r2_txq_line( struct r2_txq * q, int on ) {
+    int bits = 0;
+    if( R2_TXQ_RTS == q->direction ) bits = TIOCM_RTS;
+    else if( R2_TXQ_DTR == q->direction ) bits = TIOCM_DTR;
+    else return;
+    if( -1 == ioctl( q->sfd, on ? TIOCMBIS : TIOCMBIC, &bits ) ) {
+        perror( "ioctl(TIOCMBIS/TIOCMBIC)" );
+        fputs( "could not set RTS/DTR, writing as if full duplex\n", stderr );
+        q->direction = R2_TXQ_FULL_DUPLEX;
+    }
+}
+
+
+// has the last byte left the transmit shift register (or, without
+// TIOCSERGETLSR, the driver's output queue)? never blocks
+static int r2_txq_sent( struct r2_txq * q ) {
+    if( q->lsr ) {
+        int lsr = 0;
+        if( 0 == ioctl( q->sfd, TIOCSERGETLSR, &lsr ) ) {
+            return lsr & TIOCSER_TEMT;
+        }
+        q->lsr = 0;
+    }
+    int queued = 0;
+    if( -1 == ioctl( q->sfd, TIOCOUTQ, &queued ) ) {
+        return 1; // not a tty, so nothing is left to drain
+    }
+    return 0 == queued;
+}
+
+
+// write the next length bytes of the current frame (the port is blocking,
+// so all of them, unless it fails, which drops the rest of the frame)
+static int r2_txq_write( struct r2_txq * q, size_t length ) {
+    const uint8_t * data = q->current->data + q->sent;
+    size_t written = 0;
+    while( written < length ) {
+        ssize_t n = write( q->sfd, data + written, length - written );
+        if( -1 == n ) {
+            if( EINTR == errno ) continue;
+            perror( "write()" );
+            fputs( "dropping the rest of the frame\n", stderr );
+            q->sent = q->current->length;
+            return written;
+        }
+        written += n;
+    }
+    q->sent += written;
+    return written;
+}
+
+
+// take the next step for the frame being sent, or start the next one that
+// is due; call whenever the timer is readable
+void r2_txq_service( struct r2_txq * q ) {
+    uint64_t expirations;
+    read( q->tfd, &expirations, sizeof( expirations ) );
+    for( ;; ) {
+        int64_t now = r2_txq_usec_now();
+        switch( q->state ) {
+            case R2_TXQ_IDLE: {
+                if( 0 == q->n ) {
+                    r2_txq_arm( q, 0 );
+                    return;
+                }
+                int64_t start = q->order[0]->due > q->ready
+                    ? q->order[0]->due : q->ready;
+                if( start > now ) {
+                    r2_txq_arm( q, start );
+                    return;
+                }
+                q->current = q->order[0];
+                q->n--;
+                memmove( q->order, q->order + 1, q->n * sizeof( q->order[0] ) );
+                q->sent = 0;
+                r2_txq_line( q, 1 );
+                q->state = R2_TXQ_SENDING;
+                break;
+            }
+            case R2_TXQ_SENDING: {
+                size_t remaining = q->current->length - q->sent;
+                int written = r2_txq_write( q, q->char_gap ? 1 : remaining );
+                if( q->sent < q->current->length && q->char_gap ) {
+                    r2_txq_arm( q, now + q->char_usec + q->char_gap );
+                    return;
+                }
+                q->state = R2_TXQ_DRAINING;
+                r2_txq_arm( q, now + written * q->char_usec );
+                return;
+            }
+            case R2_TXQ_DRAINING: {
+                if( R2_TXQ_FULL_DUPLEX != q->direction ) {
+                    if( !r2_txq_sent( q ) ) {
+                        r2_txq_arm( q, now + q->char_usec );
+                        return;
+                    }
+                    r2_txq_line( q, 0 );
+                }
+                uint64_t number = q->current->number;
+                q->free[q->nfree++] = q->current;
+                q->current = NULL;
+                q->ready = r2_txq_usec_now() + q->frame_gap;
+                q->state = R2_TXQ_IDLE;
+                if( q->sent_handler ) {
+                    q->sent_handler( q->user, number );
+                    // a frame the handler queued has already been started
+                    if( R2_TXQ_IDLE != q->state ) return;
+                }
+                break;
+            }
+        }
+    }
+}
+
+
+// queue a frame to send at utime (if scheduled), or as soon as the port and
+// the gaps allow; returns -1 if the queue is full or the frame too long, and
+// otherwise numbers the frame q->queued
+int r2_txq_push( struct r2_txq * q, int64_t utime, const uint8_t * data,
+        size_t length ) {
+    if( 0 == q->nfree ) {
+        fprintf( stderr, "%d frames already waiting to be sent, dropping one\n",
+                R2_TXQ_SLOTS );
+        return -1;
+    }
+    if( length > R2_TXQ_MAX_LENGTH ) {
+        fprintf( stderr, "%zu bytes is too long to send\n", length );
+        return -1;
+    }
+    struct r2_txq_frame * f = q->free[--(q->nfree)];
+    f->number = ++(q->queued);
+    f->due = q->scheduled
+        ? utime - r2_epoch_usec_now() + r2_txq_usec_now() : 0;
+    f->length = length;
+    memcpy( f->data, data, length );
+
+    // after every frame due no later than this one
+    int k = q->n;
+    while( k > 0 && q->order[k - 1]->due > f->due ) {
+        q->order[k] = q->order[k - 1];
+        k--;
+    }
+    q->order[k] = f;
+    q->n++;
+
+    // start it now if the port is idle, or re-arm the timer if it was
+    // waiting for a frame due later than this one
+    if( R2_TXQ_IDLE == q->state ) r2_txq_service( q );
+    return 0;
+}
+
+#endif // _R2_TXQ_H_
@@ -0,0 +1,366 @@
+// shared.h
+// What serial-lcm-bridge and framed-serial-lcm-bridge share beyond
+// bridges.h: the options for realtime scheduling, tracing, routing, pacing
+// and compression, the setup they drive, and the LCM handlers that write
+// through a demux (r2_demux.h) or a transmit queue (r2_txq.h).
+// simple-serial-lcm-bridge has none of these.
+//
+// The options are an argp child: a bridge lists `shared_children` in its
+// argp, keeps a `struct shared_arguments` in its arguments, and points
+// `state->child_inputs[0]` at it on ARGP_KEY_INIT.
+
+#ifndef _SHARED_H
+#define _SHARED_H
+
+#include "bridges.h"
+#include "r2_demux.h"
+#include "r2_rt.h"
+
+static struct argp_option shared_options[] = {
+    { "realtime", 'R', "priority", 0,
+        "lock memory and run with SCHED_FIFO at priority" },
+    { "cpu", 'C', "cpu", 0, "pin to cpu" },
+    { "trace", 'T', "seconds", 0,
+        "publish a latency summary every so many seconds" },
+    { "address", 'a', "offset", 0,
+        "route frames by the address byte at offset" },
+    { "nmea", 'n', 0, 0, "route NMEA sentences by sentence or talker ID" },
+    { "route", 'r', "key", 0,
+        "publish frames for key (hex address or NMEA ID) on their own channel" },
+    { "window", 'w', "msec", 0,
+        "hold the bus after each write until a response or msec passes" },
+    { "frame-gap", 'g', "usec", 0, "wait at least usec between frames written" },
+    { "char-gap", 'k', "usec", 0, "wait usec between characters written" },
+    { "direction", 'd', "line", 0,
+        "for half duplex, assert rts or dtr while writing" },
+    { "scheduled", 's', 0, 0, "write each message at its utime" },
+#ifdef HAVE_ZSTD
+    { "compress", 'z', "dictionary", OPTION_ARG_OPTIONAL,
+        "also publish frames compressed with zstd (and a dictionary)" },
+    { "compress-cpu", 'Z', "cpu", 0, "pin the compression worker to cpu" },
+#endif
+    { 0 }
+};
+
+struct shared_arguments {
+    int realtime;
+    int cpu;
+    int trace;
+    enum r2_demux_mode demux;
+    size_t address;
+    char * routes[R2_DEMUX_MAX_ROUTES];
+    int nroutes;
+    int window;
+    int64_t frame_gap;
+    int64_t char_gap;
+    enum r2_txq_direction direction;
+    int scheduled;
+    int compress;
+    char * dictionary;
+    int compress_cpu;
+};
+
+// microseconds from arg, or an argp error if it is not a count of them
+static int64_t shared_parse_usec( const char * arg, struct argp_state * state,
+        const char * what ) {
+    char * end = NULL;
+    long long usec = strtoll( arg, &end, 0 );
+    if( end == arg || '\0' != *end || usec < 0 ) {
+        argp_error( state, "%s must be a non-negative number of microseconds",
+                what );
+    }
+    return usec;
+}
+
+// a CPU number from arg, or an argp error if it is not one
+static int shared_parse_cpu( const char * arg, struct argp_state * state ) {
+    char * end = NULL;
+    long cpu = strtol( arg, &end, 0 );
+    if( end == arg || '\0' != *end || cpu < 0 || cpu >= CPU_SETSIZE ) {
+        argp_error( state, "cpu must be 0 to %d", CPU_SETSIZE - 1 );
+    }
+    return (int)cpu;
+}
+
+static error_t shared_parse_opt( int key, char *arg, struct argp_state *state ) {
+    struct shared_arguments *shared = (struct shared_arguments *)state->input;
+    switch( key ){
+        case ARGP_KEY_INIT:
+            shared->realtime = 0;
+            shared->cpu = -1;
+            shared->trace = 0;
+            shared->demux = R2_DEMUX_NONE;
+            shared->address = 0;
+            shared->nroutes = 0;
+            shared->window = 0;
+            shared->frame_gap = 0;
+            shared->char_gap = 0;
+            shared->direction = R2_TXQ_FULL_DUPLEX;
+            shared->scheduled = 0;
+            shared->compress = 0;
+            shared->dictionary = NULL;
+            shared->compress_cpu = -1;
+            break;
+        case 'R':
+            shared->realtime = atoi( arg );
+            if( shared->realtime < 1 || shared->realtime > 99 ) {
+                argp_error( state, "realtime priority must be 1 to 99" );
+            }
+            break;
+        case 'C':
+            shared->cpu = shared_parse_cpu( arg, state );
+            break;
+        case 'T':
+            shared->trace = atoi( arg );
+            if( shared->trace < 1 ) {
+                argp_error( state, "trace period must be at least 1 second" );
+            }
+            break;
+        case 'a':
+            shared->demux = R2_DEMUX_ADDRESS;
+            shared->address = strtoul( arg, NULL, 0 );
+            break;
+        case 'n':
+            shared->demux = R2_DEMUX_NMEA;
+            break;
+        case 'r':
+            if( R2_DEMUX_MAX_ROUTES - 1 == shared->nroutes ) {
+                argp_error( state, "at most %d routes", R2_DEMUX_MAX_ROUTES - 1 );
+            }
+            shared->routes[shared->nroutes++] = arg;
+            break;
+        case 'w':
+            shared->window = atoi( arg );
+            if( shared->window < 0 ) {
+                argp_error( state, "response window must not be negative" );
+            }
+            break;
+        case 'g':
+            shared->frame_gap = shared_parse_usec( arg, state, "frame gap" );
+            break;
+        case 'k':
+            shared->char_gap = shared_parse_usec( arg, state,
+                    "character gap" );
+            break;
+        case 'd':
+            if( 0 == strcmp( arg, "rts" ) ) {
+                shared->direction = R2_TXQ_RTS;
+            } else if( 0 == strcmp( arg, "dtr" ) ) {
+                shared->direction = R2_TXQ_DTR;
+            } else {
+                argp_usage( state );
+            }
+            break;
+        case 's':
+            shared->scheduled = 1;
+            break;
+        case 'z':
+            shared->compress = 1;
+            shared->dictionary = arg;
+            break;
+        case 'Z':
+            shared->compress_cpu = shared_parse_cpu( arg, state );
+            break;
+        case ARGP_KEY_END:
+            if( shared->nroutes && R2_DEMUX_NONE == shared->demux ) {
+                argp_error( state, "routes need --address or --nmea" );
+            }
+            if( shared->compress_cpu >= 0 && !shared->compress ) {
+                argp_error( state, "--compress-cpu needs --compress" );
+            }
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+static struct argp shared_argp = { shared_options, shared_parse_opt, 0, 0 };
+
+static struct argp_child shared_children[] = {
+    { &shared_argp, 0, 0, 0 },
+    { 0 }
+};
+
+// frame routing and write arbitration, NULL unless --address or --nmea
+struct r2_demux * demux = NULL;
+
+// paces writes to the serial port, NULL unless a gap, direction control or
+// scheduling is asked for
+struct r2_txq * txq = NULL;
+
+// latency summaries, when tracing (-T)
+static struct {
+    int fd; // timer, -1 when not tracing
+    struct r2_trace_ring * ring;
+    const char * channel;
+    int64_t period; // microseconds
+} latency = { -1, NULL, NULL, 0 };
+
+// subscribe with lcm_subscribe, user points to the r2_txq to write through
+static void txq_handler( const lcm_recv_buf_t *rbuf, const char * channel,
+        void * user ) {
+    raw_bytes_t msg;
+    if( 0 > raw_bytes_view( rbuf->data, rbuf->data_size, &msg ) ) {
+        fprintf( stderr, "could not decode raw_bytes_t on %s\n", channel );
+        return;
+    }
+    r2_txq_push( (struct r2_txq *)user, msg.utime, msg.data, msg.length );
+}
+
+// subscribe with lcm_subscribe, user points to the r2_demux_route to write on
+static void demux_handler( const lcm_recv_buf_t *rbuf, const char * channel,
+        void * user ) {
+    raw_bytes_t msg;
+    if( 0 > raw_bytes_view( rbuf->data, rbuf->data_size, &msg ) ) {
+        fprintf( stderr, "could not decode raw_bytes_t on %s\n", channel );
+        return;
+    }
+    r2_demux_write( (struct r2_demux_route *)user, msg.utime, msg.data,
+            msg.length );
+}
+
+// subscribe to the input channel of every route
+static void demux_subscribe( lcm_t * lio, struct r2_demux * d ) {
+    for( int r = 0; r < d->nroutes; r++ ) {
+        lcm_subscribe( lio, d->routes[r].input, &demux_handler,
+                (void *)&(d->routes[r]) );
+    }
+}
+
+
+// open what the options ask for, and subscribe to the input channel (and
+// those of the routes) to write to the serial port *sfd; everything is
+// allocated here, before shared_realtime locks memory
+static void shared_setup( const struct shared_arguments * shared,
+        int verbosity, lcm_t * lio, int * sfd, const struct termios * tio,
+        const char * input, const char * output, const char * trace ) {
+    if( shared->frame_gap || shared->char_gap || shared->direction
+            || shared->scheduled ) {
+        txq = r2_txq_open( *sfd, tio, shared->frame_gap, shared->char_gap,
+                shared->direction, shared->scheduled );
+        if( verbosity > 0 ) {
+            printf( "pacing writes: %" PRId64 " us/char, %" PRId64 " us between"
+                    " frames, %" PRId64 " us between characters\n",
+                    txq->char_usec, txq->frame_gap, txq->char_gap );
+        }
+    }
+
+    if( R2_DEMUX_NONE == shared->demux && NULL == txq ) {
+        lcm_subscribe( lio, input, &raw_handler, (void *)sfd );
+    } else if( R2_DEMUX_NONE == shared->demux ) {
+        lcm_subscribe( lio, input, &txq_handler, (void *)txq );
+    } else {
+        demux = r2_demux_open( shared->demux, shared->address, *sfd,
+                shared->window * 1000L, output, input );
+        if( txq ) r2_demux_pace( demux, txq );
+        for( int r = 0; r < shared->nroutes; r++ ) {
+            if( -1 == r2_demux_add( demux, shared->routes[r] ) ) {
+                exit( EXIT_FAILURE );
+            }
+        }
+        if( verbosity >= 0 ) {
+            for( int r = 1; r < demux->nroutes; r++ ) {
+                printf( "route: %s, %s\n", demux->routes[r].input,
+                        demux->routes[r].output );
+            }
+        }
+        demux_subscribe( lio, demux );
+    }
+
+#ifdef HAVE_ZSTD
+    if( shared->compress ) {
+        zbytes = zbytes_open( lio, shared->dictionary );
+        if( verbosity >= 0 ) {
+            printf( "compressed channels: *%s, dictionary %u\n", ZBYTES_SUFFIX,
+                    zbytes->dictionary );
+        }
+    }
+#endif
+
+    if( shared->trace ) {
+        latency.ring = r2_trace_open();
+        latency.period = shared->trace * 1000000L;
+        latency.fd = r2_trace_timer( latency.period );
+        latency.channel = trace;
+        if( verbosity >= 0 ) printf( "trace channel: %s\n", trace );
+    }
+}
+
+
+// add the timers opened by shared_setup to epoll; returns -1 on failure
+static int shared_watch( int epfd, int verbosity ) {
+    struct {
+        int fd;
+        const char * name;
+    } timers[3] = {
+        { txq ? txq->tfd : -1, "transmit timer" },
+        { demux ? demux->tfd : -1, "response window" },
+        { latency.fd, "trace timer" }
+    };
+    struct epoll_event ev;
+    memset( &ev, 0, sizeof( ev ) );
+    ev.events = EPOLLIN;
+    for( int k = 0; k < 3; k++ ) {
+        if( -1 == timers[k].fd ) continue;
+        ev.data.fd = timers[k].fd;
+        if( -1 == epoll_ctl( epfd, EPOLL_CTL_ADD, ev.data.fd, &ev ) ) {
+            perror( "epoll_ctl" );
+            fprintf( stderr, "failed to add %s fd %d to epoll\n",
+                    timers[k].name, ev.data.fd );
+            return -1;
+        } else if( verbosity > 0 ) {
+            printf( "added %s fd %d to epoll\n", timers[k].name, ev.data.fd );
+        }
+    }
+    return 0;
+}
+
+
+// handle fd if epoll woke for one of the timers opened by shared_setup;
+// returns 0 if it is not one of them
+static int shared_handle( lcm_t * lio, int fd ) {
+    if( txq && txq->tfd == fd ) {
+        r2_txq_service( txq );
+    } else if( demux && demux->tfd == fd ) {
+        r2_demux_timeout( demux );
+    } else if( -1 != latency.fd && latency.fd == fd ) {
+        uint64_t expirations;
+        read( latency.fd, &expirations, sizeof( expirations ) );
+        latency_publish( lio, latency.channel, latency.ring, latency.period );
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+
+// lock memory and set the priority and CPU of the calling thread, as asked,
+// and pin the compression worker (which stays SCHED_OTHER, so that it never
+// delays the bridge)
+static void shared_realtime( const struct shared_arguments * shared,
+        int verbosity ) {
+    if( shared->realtime ) {
+        r2_rt_lock_memory();
+        if( verbosity > 0 ) {
+            puts( "locked memory" );
+        }
+    }
+    if( shared->realtime || shared->cpu >= 0 ) {
+        r2_rt_schedule( pthread_self(), shared->realtime, shared->cpu );
+        if( verbosity > 0 ) {
+            printf( "scheduling with priority %d on cpu %d\n", shared->realtime,
+                    shared->cpu );
+        }
+    }
+#ifdef HAVE_ZSTD
+    if( zbytes && shared->compress_cpu >= 0 ) {
+        r2_rt_schedule( zbytes->thread, 0, shared->compress_cpu );
+        if( verbosity > 0 ) {
+            printf( "compressing on cpu %d\n", shared->compress_cpu );
+        }
+    }
+#endif
+}
+
+#endif // _SHARED_H
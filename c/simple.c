@@ -15,19 +15,22 @@ static void sfd_handle( const int sfd, const char * channel, lcm_t * lio ) {
     };
     usleep( SLEEP_MICROSECONDS );
     msg.length = read( sfd, msg.data, MAX_LENGTH );
+    R2_TRACE( R2_TRACE_READ );
     if( args.verbosity > 1 ) {
         for( int j = 0; j < msg.length; j++ ) {
             putchar( msg.data[j] );
         }
         putchar( '\n' );
     }
-    raw_bytes_t_publish( lio, channel, &msg );
+    R2_TRACE( R2_TRACE_FRAMED );
+    raw_bytes_publish( lio, channel, &msg, lcm_buffer, sizeof( lcm_buffer ) );
 }
 
 
 int main( int argc, char ** argv ) {
     args.verbosity = 0;
     args.baudrate = B9600;
+    args.trace = 0;
     argp_parse( &argp, argc, argv, 0, 0, &args );
 
     if( 0 > cfsetispeed( &tio, args.baudrate ) || 0 > cfsetospeed( &tio, args.baudrate ) ) {
@@ -65,12 +68,16 @@ int main( int argc, char ** argv ) {
     char output_channel[strlen( tty ) + strlen( OUTPUT_SUFFIX )];
     strcpy( output_channel, tty );
     strcat( output_channel, OUTPUT_SUFFIX );
+    char trace_channel[strlen( tty ) + strlen( TRACE_SUFFIX ) + 1];
+    strcpy( trace_channel, tty );
+    strcat( trace_channel, TRACE_SUFFIX );
     if( args.verbosity >= 0 ) {
         printf( "input channel: %s\n", input_channel );
         printf( "output channel: %s\n", output_channel );
+        if( args.trace ) printf( "trace channel: %s\n", trace_channel );
     }
 
-    raw_bytes_t_subscribe( lio, input_channel, &raw_handler, (void *)&sfd );
+    lcm_subscribe( lio, input_channel, &raw_handler, (void *)&sfd );
 
     // set up epoll to listen for input
     struct epoll_event ev = { 0 };
@@ -101,6 +108,22 @@ int main( int argc, char ** argv ) {
     } else if ( args.verbosity > 0 ) {
         printf( "added LCM fd %d to epoll\n", ev.data.fd );
     }
+    // add trace timer file descriptor to epoll
+    int tfd = -1;
+    struct r2_trace_ring * ring = NULL;
+    if( args.trace ) {
+        ring = r2_trace_open();
+        tfd = r2_trace_timer( args.trace * 1000000L );
+        ev.data.fd = tfd;
+        if( -1 == epoll_ctl( epfd, EPOLL_CTL_ADD, ev.data.fd, &ev ) ) {
+            perror( "epoll_ctl" );
+            fprintf( stderr, "failed to add trace timer fd %d to epoll",
+                    ev.data.fd );
+            exit( EXIT_FAILURE );
+        } else if ( args.verbosity > 0 ) {
+            printf( "added trace timer fd %d to epoll\n", ev.data.fd );
+        }
+    }
     // clear epoll event to re-use
     memset( &ev, 0, sizeof( ev ) );
     int nfds = 0;
@@ -124,9 +147,15 @@ int main( int argc, char ** argv ) {
                             " and it triggered without EPOLLIN\n" );
                     continue;
                 } else if ( sfd == ev.data.fd ) {
+                    R2_TRACE( R2_TRACE_WAKE );
                     sfd_handle( sfd, output_channel, lio );
                 } else if ( lfd == ev.data.fd ) {
                     lcm_handle( lio );
+                } else if ( tfd == ev.data.fd ) {
+                    uint64_t expirations;
+                    read( tfd, &expirations, sizeof( expirations ) );
+                    latency_publish( lio, trace_channel, ring,
+                            args.trace * 1000000L );
                 } else {
                     fprintf( stderr, "unexpected fd %d\n", ev.data.fd );
                     loop = 0;
@@ -138,6 +167,7 @@ int main( int argc, char ** argv ) {
     }
 
     close( epfd );
+    if( -1 != tfd ) close( tfd );
     lcm_destroy( lio );
     close( sfd );
 
@@ -11,6 +11,8 @@ static struct argp_option options[] = {
     { "verbose", 'v', 0, 0, "say more" },
     { "quiet", 'q', 0, 0, "say less" },
     { "baudrate", 'b', "baudrate", 0, "baudrate" },
+    { "trace", 'T', "seconds", 0,
+        "publish a latency summary every so many seconds" },
     { 0 }
 };
 
@@ -18,6 +20,7 @@ struct arguments {
     char * dev;
     int8_t verbosity;
     speed_t baudrate;
+    int trace;
 };
 
 static error_t parse_opt( int key, char *arg, struct argp_state *state ) {
@@ -32,6 +35,12 @@ static error_t parse_opt( int key, char *arg, struct argp_state *state ) {
         case 'b':
             args->baudrate = char_to_baudrate( arg );
             break;
+        case 'T':
+            args->trace = atoi( arg );
+            if( args->trace < 1 ) {
+                argp_error( state, "trace period must be at least 1 second" );
+            }
+            break;
         case ARGP_KEY_ARG:
             if( state->arg_num >= 1 ) argp_usage( state );
             args->dev = arg;
@@ -58,4 +67,7 @@ struct termios tio = {
         .c_cc[VTIME] = 1,
 };
 
+// allocated up front, so that nothing is allocated per message
+uint8_t lcm_buffer[RAW_BYTES_ENCODED_SIZE( MAX_LENGTH )];
+
 #endif // _SIMPLE_H
@@ -0,0 +1,313 @@
+// zbytes.h
+// Compressed raw_bytes_t: compress on a worker thread, decompress for
+// subscribers
+//
+// A bridge that compresses publishes each frame twice: as raw_bytes_t on its
+// channel, and as raw_zbytes_t on the same channel with ZBYTES_SUFFIX. The
+// serial path only copies the frame into a queue, and a worker thread
+// compresses and publishes it, so compression never holds up a serial read.
+//
+// Frames from one instrument tend to look alike, so a dictionary trained on
+// them (`zstd --train`) makes even small frames compress well. Subscribers
+// need the same dictionary; each message carries its ID.
+
+#ifndef _ZBYTES_H_
+#define _ZBYTES_H_
+
+#define ZBYTES_SUFFIX "z"
+#define ZBYTES_MAX_LENGTH 4096 // bytes per frame, as MAX_LENGTH in complex.h
+#define ZBYTES_QUEUE 64 // frames waiting for the worker, must be a power of two
+#define ZBYTES_QUEUE_MASK ( ZBYTES_QUEUE - 1 )
+#define ZBYTES_MAX_CHANNEL 64
+#define ZBYTES_MAX_DICTIONARIES 16
+#define ZBYTES_LEVEL 3
+
+// encoded size of a raw_zbytes_t: fingerprint, utime, length, dictionary,
+// size, then the data
+#define ZBYTES_ENCODED_SIZE( size ) ( 8 + 8 + 4 + 4 + 4 + ( size ) )
+
+#include <inttypes.h> // for int64_t, uint64_t
+#include <pthread.h> // for pthread_create
+#include <stdio.h> // for fopen, fread
+#include <stdlib.h> // for calloc
+#include <string.h> // for memcpy, strlen
+#include <sys/eventfd.h> // for eventfd
+#include <unistd.h> // for read, write
+
+#include <zstd.h>
+
+#include <lcm/lcm.h>
+#include "raw_bytes_t.h"
+#include "raw_zbytes_t.h"
+
+struct zbytes_frame {
+    const char * channel; // must outlive the frame, as channel names do
+    int64_t utime;
+    int32_t length;
+    uint8_t data[ZBYTES_MAX_LENGTH];
+};
+
+struct zbytes_worker {
+    lcm_t * lio;
+    ZSTD_CCtx * cctx;
+    ZSTD_CDict * cdict; // NULL to compress without a dictionary
+    unsigned int dictionary;
+    int efd; // counts frames queued
+    pthread_t thread;
+    uint64_t head; // written only by the serial thread
+    uint64_t tail; // written only by the worker
+    uint64_t dropped;
+    struct zbytes_frame queue[ZBYTES_QUEUE];
+    char channel[ZBYTES_MAX_CHANNEL];
+    uint8_t compressed[ZSTD_COMPRESSBOUND( ZBYTES_MAX_LENGTH )];
+    uint8_t encoded[ZBYTES_ENCODED_SIZE( ZSTD_COMPRESSBOUND( ZBYTES_MAX_LENGTH ) )];
+};
+
+struct zbytes_reader;
+
+typedef void ( * zbytes_handler_t )( const char * channel,
+        const raw_bytes_t * msg, void * user );
+
+struct zbytes_reader {
+    ZSTD_DCtx * dctx;
+    int ndictionaries;
+    unsigned int ids[ZBYTES_MAX_DICTIONARIES];
+    ZSTD_DDict * ddicts[ZBYTES_MAX_DICTIONARIES];
+    zbytes_handler_t handler;
+    void * user;
+    uint8_t data[ZBYTES_MAX_LENGTH];
+};
+
+
+// read a whole dictionary file into memory allocated for it
+void * zbytes_load_dictionary( const char * path, size_t * size ) {
+    FILE * fp = fopen( path, "rb" );
+    if( NULL == fp ) {
+        perror( "fopen()" );
+        fprintf( stderr, "could not open dictionary %s\n", path );
+        exit( EXIT_FAILURE );
+    }
+    fseek( fp, 0, SEEK_END );
+    long length = ftell( fp );
+    rewind( fp );
+    void * buf = malloc( length > 0 ? length : 1 );
+    if( NULL == buf || length != (long)fread( buf, 1, length, fp ) ) {
+        fprintf( stderr, "could not read dictionary %s\n", path );
+        exit( EXIT_FAILURE );
+    }
+    fclose( fp );
+    *size = length;
+    return buf;
+}
+
+
+static void zbytes_compress( struct zbytes_worker * w,
+        const struct zbytes_frame * f ) {
+    size_t size = w->cdict
+        ? ZSTD_compress_usingCDict( w->cctx, w->compressed,
+                sizeof( w->compressed ), f->data, f->length, w->cdict )
+        : ZSTD_compressCCtx( w->cctx, w->compressed, sizeof( w->compressed ),
+                f->data, f->length, ZBYTES_LEVEL );
+    if( ZSTD_isError( size ) ) {
+        fprintf( stderr, "could not compress %d-byte frame: %s\n", f->length,
+                ZSTD_getErrorName( size ) );
+        return;
+    }
+
+    raw_zbytes_t msg;
+    msg.utime = f->utime;
+    msg.length = f->length;
+    msg.dictionary = w->dictionary;
+    msg.size = size;
+    msg.data = w->compressed;
+    int n = raw_zbytes_t_encode( w->encoded, 0, sizeof( w->encoded ), &msg );
+    if( n < 0 ) {
+        fprintf( stderr, "could not encode %zu-byte compressed frame\n", size );
+        return;
+    }
+    snprintf( w->channel, sizeof( w->channel ), "%s%s", f->channel,
+            ZBYTES_SUFFIX );
+    lcm_publish( w->lio, w->channel, w->encoded, n );
+}
+
+
+static void * zbytes_work( void * arg ) {
+    struct zbytes_worker * w = (struct zbytes_worker *)arg;
+    uint64_t queued;
+    for( ;; ) {
+        if( -1 == read( w->efd, &queued, sizeof( queued ) ) ) {
+            perror( "read()" );
+            return NULL;
+        }
+        uint64_t head = __atomic_load_n( &(w->head), __ATOMIC_ACQUIRE );
+        uint64_t tail = w->tail;
+        for( ; tail != head; tail++ ) {
+            zbytes_compress( w, &(w->queue[tail & ZBYTES_QUEUE_MASK]) );
+            __atomic_store_n( &(w->tail), tail + 1, __ATOMIC_RELEASE );
+        }
+        uint64_t dropped = __atomic_exchange_n( &(w->dropped), 0,
+                __ATOMIC_RELAXED );
+        if( dropped ) {
+            fprintf( stderr, "compression fell behind, %" PRIu64
+                    " frames not compressed\n", dropped );
+        }
+    }
+    return NULL;
+}
+
+
+// start a worker that publishes through lio (lcm_publish is thread-safe),
+// with the dictionary at path, or none if path is NULL; start it before
+// setting real-time priority, so that it does not inherit that priority
+struct zbytes_worker * zbytes_open( lcm_t * lio, const char * path ) {
+    struct zbytes_worker * w =
+        (struct zbytes_worker *)calloc( 1, sizeof( struct zbytes_worker ) );
+    if( NULL == w ) {
+        perror( "calloc()" );
+        fputs( "could not allocate compression queue\n", stderr );
+        exit( EXIT_FAILURE );
+    }
+    w->lio = lio;
+    w->cctx = ZSTD_createCCtx();
+    if( path ) {
+        size_t size = 0;
+        void * dictionary = zbytes_load_dictionary( path, &size );
+        // readers find the dictionary by its ID, and raw content has none
+        w->dictionary = ZSTD_getDictID_fromDict( dictionary, size );
+        if( 0 == w->dictionary ) {
+            fprintf( stderr, "dictionary %s has no ID; train it with "
+                    "zstd --train\n", path );
+            exit( EXIT_FAILURE );
+        }
+        w->cdict = ZSTD_createCDict( dictionary, size, ZBYTES_LEVEL );
+        free( dictionary );
+        if( NULL == w->cdict ) {
+            fprintf( stderr, "could not load dictionary %s\n", path );
+            exit( EXIT_FAILURE );
+        }
+    }
+    w->efd = eventfd( 0, 0 );
+    if( -1 == w->efd || NULL == w->cctx ) {
+        perror( "eventfd()" );
+        fputs( "could not start compression\n", stderr );
+        exit( EXIT_FAILURE );
+    }
+    int error = pthread_create( &(w->thread), NULL, &zbytes_work, w );
+    if( error ) {
+        fprintf( stderr, "pthread_create(): %s\n", strerror( error ) );
+        fputs( "could not start compression worker\n", stderr );
+        exit( EXIT_FAILURE );
+    }
+    return w;
+}
+
+
+// queue a frame for the worker, or count it as dropped if the queue is full
+void zbytes_post( struct zbytes_worker * w, const char * channel,
+        const raw_bytes_t * msg ) {
+    uint64_t head = w->head;
+    if( ZBYTES_QUEUE == head - __atomic_load_n( &(w->tail), __ATOMIC_ACQUIRE )
+            || msg->length > ZBYTES_MAX_LENGTH ) {
+        __atomic_add_fetch( &(w->dropped), 1, __ATOMIC_RELAXED );
+        return;
+    }
+    struct zbytes_frame * f = &(w->queue[head & ZBYTES_QUEUE_MASK]);
+    f->channel = channel;
+    f->utime = msg->utime;
+    f->length = msg->length;
+    memcpy( f->data, msg->data, msg->length );
+    __atomic_store_n( &(w->head), head + 1, __ATOMIC_RELEASE );
+    uint64_t one = 1;
+    write( w->efd, &one, sizeof( one ) );
+}
+
+
+struct zbytes_reader * zbytes_reader_open( zbytes_handler_t handler,
+        void * user ) {
+    struct zbytes_reader * r =
+        (struct zbytes_reader *)calloc( 1, sizeof( struct zbytes_reader ) );
+    if( NULL == r || NULL == ( r->dctx = ZSTD_createDCtx() ) ) {
+        fputs( "could not start decompression\n", stderr );
+        exit( EXIT_FAILURE );
+    }
+    r->handler = handler;
+    r->user = user;
+    return r;
+}
+
+
+// add a dictionary that messages may have been compressed with
+void zbytes_reader_add_dictionary( struct zbytes_reader * r,
+        const char * path ) {
+    if( ZBYTES_MAX_DICTIONARIES == r->ndictionaries ) {
+        fprintf( stderr, "too many dictionaries, at most %d\n",
+                ZBYTES_MAX_DICTIONARIES );
+        exit( EXIT_FAILURE );
+    }
+    size_t size = 0;
+    void * dictionary = zbytes_load_dictionary( path, &size );
+    ZSTD_DDict * ddict = ZSTD_createDDict( dictionary, size );
+    free( dictionary );
+    if( NULL == ddict ) {
+        fprintf( stderr, "could not load dictionary %s\n", path );
+        exit( EXIT_FAILURE );
+    }
+    r->ids[r->ndictionaries] = ZSTD_getDictID_fromDDict( ddict );
+    r->ddicts[r->ndictionaries] = ddict;
+    r->ndictionaries++;
+}
+
+
+// decompress msg and pass it to the reader's handler as raw_bytes_t
+int zbytes_decompress( struct zbytes_reader * r, const char * channel,
+        const raw_zbytes_t * msg ) {
+    ZSTD_DDict * ddict = NULL;
+    for( int k = 0; k < r->ndictionaries && msg->dictionary; k++ ) {
+        if( (unsigned int)msg->dictionary == r->ids[k] ) ddict = r->ddicts[k];
+    }
+    if( msg->dictionary && NULL == ddict ) {
+        fprintf( stderr, "no dictionary %u for %s\n",
+                (unsigned int)msg->dictionary, channel );
+        return -1;
+    }
+    if( msg->length < 0 || msg->length > ZBYTES_MAX_LENGTH ) {
+        fprintf( stderr, "%d-byte frame on %s is too long\n", msg->length,
+                channel );
+        return -1;
+    }
+    size_t length = ddict
+        ? ZSTD_decompress_usingDDict( r->dctx, r->data, sizeof( r->data ),
+                msg->data, msg->size, ddict )
+        : ZSTD_decompressDCtx( r->dctx, r->data, sizeof( r->data ),
+                msg->data, msg->size );
+    if( ZSTD_isError( length ) || length != (size_t)msg->length ) {
+        fprintf( stderr, "could not decompress frame on %s\n", channel );
+        return -1;
+    }
+    raw_bytes_t bytes;
+    bytes.utime = msg->utime;
+    bytes.length = msg->length;
+    bytes.data = r->data;
+    r->handler( channel, &bytes, r->user );
+    return 0;
+}
+
+
+static void zbytes_handler( const lcm_recv_buf_t * rbuf, const char * channel,
+        const raw_zbytes_t * msg, void * user ) {
+    zbytes_decompress( (struct zbytes_reader *)user, channel, msg );
+}
+
+
+// subscribe to compressed messages on channel (including ZBYTES_SUFFIX),
+// and receive them decompressed, e.g.:
+//
+//     struct zbytes_reader * r = zbytes_reader_open( &on_bytes, NULL );
+//     zbytes_reader_add_dictionary( r, "sonar.dict" );
+//     zbytes_subscribe( lio, "ttyUSB0oz", r );
+raw_zbytes_t_subscription_t * zbytes_subscribe( lcm_t * lio,
+        const char * channel, struct zbytes_reader * r ) {
+    return raw_zbytes_t_subscribe( lio, channel, &zbytes_handler, r );
+}
+
+#endif // _ZBYTES_H_
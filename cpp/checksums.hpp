@@ -0,0 +1,57 @@
+// checksums.hpp
+//
+// Checksum policies for the framers in framers.hpp.
+//
+// Each policy provides the size of its trailer and a static `check` over the
+// payload, so the framer that uses it is compiled without any runtime test
+// of which checksum (if any) is configured.
+
+#ifndef CHECKSUMS_HPP_
+#define CHECKSUMS_HPP_
+
+#include <cstddef>        // for std::size_t
+#include <cstdint>        // for std::uint8_t, std::uint32_t
+
+#include <boost/crc.hpp>  // for boost::crc_optimal, boost::crc_32_type
+
+
+// no checksum: every complete frame is accepted
+//
+struct NoChecksum{
+    static constexpr std::size_t size = 0;
+
+    static bool check(const std::uint8_t *, std::size_t, const std::uint8_t *)
+    { return true; }
+};
+
+
+// checksum over the payload, stored as a little-endian trailer
+//
+// The default trailer width matches python/bridge.py, which packs a 16-bit
+// XMODEM checksum into a `<I` struct.
+//
+template<class Crc, std::size_t Size = 4>
+struct LittleEndianChecksum{
+    static constexpr std::size_t size = Size;
+
+    static bool check(const std::uint8_t *payload, std::size_t length,
+            const std::uint8_t *trailer)
+    {
+        Crc crc;
+        crc.process_bytes(payload, length);
+        std::uint32_t read = 0;
+        for(std::size_t k = 0; k < Size; ++k){
+            read |= std::uint32_t(trailer[k]) << (8 * k);
+        }
+        return read == std::uint32_t(crc.checksum());
+    }
+};
+
+// boost::crc_xmodem_type is the reflected (KERMIT) variant, so spell out
+// the CRC-16/XMODEM parameters that crcmod uses
+typedef LittleEndianChecksum<boost::crc_optimal<16, 0x1021, 0, 0, false, false> >
+    Xmodem;
+
+typedef LittleEndianChecksum<boost::crc_32_type> Crc32;
+
+#endif // CHECKSUMS_HPP_
@@ -0,0 +1,272 @@
+// framed.cpp
+//
+// framed-serial-lcm-bridge: serial-lcm-bridge with the framing mode,
+// checksum and verbosity resolved at compile time.
+//
+// `main` parses the same options as serial-lcm-bridge and dispatches once to
+// the `run` instantiation for the configured framer, so the per-byte loop
+// never re-tests `initiator != terminator` or the verbosity level.
+
+#include <cstdint>        // for std::int64_t, std::uint8_t
+#include <cstdio>         // for std::printf, std::fprintf
+#include <cstdlib>        // for std::exit, std::atoi, std::strtoul
+#include <cstring>        // for std::strlen, std::strcpy, std::strcat
+
+#include <fcntl.h>        // for open
+
+#include "bridges.h"
+// ^ common header for all bridges
+// #includes: config.h, lcm.h, raw_bytes_t.h, r2_epoch.h, etc.
+
+#include "shared.h"
+
+#include "checksums.hpp"
+#include "framed.hpp"
+#include "framers.hpp"
+#include "tracers.hpp"
+
+
+// publishes each complete frame as raw_bytes_t, encoding into a buffer
+// allocated up front
+//
+// When tracing, each frame is timed from the wakeup and read that brought
+// its first byte. A frame that shares that read with the one published
+// before it is timed from when that one was published, so its stages do not
+// count the work spent on the frame before.
+//
+class Publisher{
+public:
+    Publisher(lcm_t *lio, const char *channel)
+    : lio(lio), channel(channel)
+    {}
+
+    void operator()(const Arrival &arrival, const std::uint8_t *data,
+            std::size_t length)
+    {
+        raw_bytes_t msg;
+        msg.utime = arrival.utime;
+        msg.length = length;
+        msg.data = const_cast<std::uint8_t *>(data);
+        if( r2_trace ) {
+            std::int64_t *t = r2_trace->current.t;
+            std::int64_t published = r2_trace->published;
+            bool shared = arrival.read < published;
+            t[R2_TRACE_WAKE] = shared ? published : arrival.wake;
+            t[R2_TRACE_READ] = shared ? published : arrival.read;
+        }
+        R2_TRACE( R2_TRACE_FRAMED );
+        const char *to = demux ? r2_demux_frame(demux, data, length) : channel;
+        raw_bytes_publish(lio, to, &msg, encoded, sizeof(encoded));
+    }
+
+private:
+    lcm_t *lio;
+    const char *channel;
+    std::uint8_t encoded[RAW_BYTES_ENCODED_SIZE(max_frame_length)];
+};
+
+
+// epoll loop over one serial port and LCM, specialized for one framer
+//
+template<class Framer>
+static int run(Framer framer, int sfd, lcm_t *lio, const char *channel)
+{
+    Publisher publish( lio, channel );
+    std::uint8_t buffer[max_frame_length];
+
+    int lfd = lcm_get_fileno( lio );
+
+    // set up epoll to listen for input
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    int epfd = epoll_create( 1 );
+    if( -1 == epfd ) {
+        perror( "epoll_create" );
+        fputs( "failed to create epoll file descriptor\n", stderr );
+        return EXIT_FAILURE;
+    }
+    ev.data.fd = sfd;
+    if( -1 == epoll_ctl( epfd, EPOLL_CTL_ADD, ev.data.fd, &ev ) ) {
+        perror( "epoll_ctl" );
+        fprintf( stderr, "failed to add serial fd %d to epoll\n", ev.data.fd );
+        return EXIT_FAILURE;
+    }
+    ev.data.fd = lfd;
+    if( -1 == epoll_ctl( epfd, EPOLL_CTL_ADD, ev.data.fd, &ev ) ) {
+        perror( "epoll_ctl" );
+        fprintf( stderr, "failed to add LCM fd %d to epoll\n", ev.data.fd );
+        return EXIT_FAILURE;
+    }
+    if( -1 == shared_watch( epfd, args.verbosity ) ) {
+        return EXIT_FAILURE;
+    }
+    if( args.verbosity > 0 ) {
+        puts( "starting epoll loop" );
+    }
+
+    int status = EXIT_SUCCESS;
+    for( ;; ) {
+        int nfds = epoll_wait( epfd, &ev, 1, -1 );
+        if( -1 == nfds ) {
+            perror( "epoll_wait" );
+            status = EXIT_FAILURE;
+            break;
+        } else if( 1 != nfds ) {
+            continue;
+        } else if( sfd == ev.data.fd ) {
+            R2_TRACE( R2_TRACE_WAKE );
+            Arrival arrival = { r2_epoch_usec_now(), 0, 0 };
+            ssize_t n = read( sfd, buffer, sizeof( buffer ) );
+            R2_TRACE( R2_TRACE_READ );
+            if( r2_trace ) {
+                // frames take these from the read that held their first byte
+                arrival.wake = r2_trace->current.t[R2_TRACE_WAKE];
+                arrival.read = r2_trace->current.t[R2_TRACE_READ];
+            }
+            if( n > 0 ) {
+                framer.feed( buffer, n, arrival, publish );
+            } else if( -1 == n ) {
+                perror( "read" );
+                status = EXIT_FAILURE;
+                break;
+            }
+        } else if( lfd == ev.data.fd ) {
+            lcm_handle( lio );
+        } else if( !shared_handle( lio, ev.data.fd ) ) {
+            fprintf( stderr, "unexpected fd %d\n", ev.data.fd );
+            status = EXIT_FAILURE;
+            break;
+        }
+    }
+
+    close( epfd );
+    return status;
+}
+
+
+template<class Checksum, class Trace>
+static int dispatch_preambled(int sfd, lcm_t *lio, const char *channel)
+{
+    return run( Preambled<Checksum, Trace>( args.preamble, args.preamble_length,
+                args.header_size, args.length_offset ), sfd, lio, channel );
+}
+
+
+// choose the framer for the configured mode, once
+//
+template<class Trace>
+static int dispatch(int sfd, lcm_t *lio, const char *channel)
+{
+    if( args.preamble_length ) {
+        switch( args.checksum ) {
+            case CHECKSUM_XMODEM:
+                return dispatch_preambled<Xmodem, Trace>( sfd, lio, channel );
+            case CHECKSUM_CRC32:
+                return dispatch_preambled<Crc32, Trace>( sfd, lio, channel );
+            default:
+                return dispatch_preambled<NoChecksum, Trace>( sfd, lio, channel );
+        }
+    } else if( args.initiator != args.terminator ) {
+        return run( Delimited<Trace>( args.initiator, args.terminator ),
+                sfd, lio, channel );
+    } else {
+        return run( Terminated<Trace>( args.terminator ), sfd, lio, channel );
+    }
+}
+
+
+int main( int argc, char ** argv ) {
+    args.verbosity = 0;
+    args.baudrate = B9600;
+    args.terminator = 0x0a;
+    args.initiator = args.terminator;
+    args.preamble_length = 0;
+    args.header_size = 0;
+    args.length_offset = 0;
+    args.checksum = CHECKSUM_NONE;
+    argp_parse( &argp, argc, argv, 0, 0, &args );
+
+    if( args.shared.realtime ) {
+        setvbuf( stdout, stdout_buffer, _IOLBF, sizeof( stdout_buffer ) );
+    }
+
+    tio.c_cflag = CS8 | CLOCAL | CREAD | B9600;
+    tio.c_iflag = IGNBRK;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 1;
+    if( 0 > cfsetispeed( &tio, args.baudrate ) || 0 > cfsetospeed( &tio, args.baudrate ) ) {
+        fprintf( stderr, "error setting baudrate\n" );
+    }
+
+    if( args.verbosity >= 0 ) {
+        if( args.preamble_length ) {
+            printf( "preamble: %zu bytes, header: %zu bytes,"
+                    " length at offset %zu\n", args.preamble_length,
+                    args.header_size, args.length_offset );
+        } else {
+            printf( "initiator: 0x%02hhx '%c'\n", args.initiator,
+                    args.initiator );
+            printf( "terminator: 0x%02hhx '%c'\n", args.terminator,
+                    args.terminator );
+        }
+    }
+
+    if( args.verbosity > 0 ) {
+        printf( "opening serial port: %s\n", args.dev );
+    }
+    // as r2_sfd_open (r2_sfd.h uses C designated initializers)
+    int sfd = open( args.dev, O_RDWR | O_NOCTTY );
+    if( -1 == sfd ) {
+        perror( "open()" );
+        fprintf( stderr, "could not open device %s\n", args.dev );
+        exit( EXIT_FAILURE );
+    }
+    if( -1 == tcsetattr( sfd, TCSAFLUSH, &tio ) ) {
+        perror( "tcsetattr()" );
+        fputs( "trouble setting termios attibutes\n", stderr );
+        exit( EXIT_FAILURE );
+    }
+    if( args.verbosity > 0 ) {
+        printf( "opened serial port with file descriptor %d\n", sfd );
+    }
+
+    if( args.verbosity > 0 ) {
+        printf( "starting LCM\n" );
+    }
+    lcm_t * lio = lcm_create( NULL );
+    if( NULL == lio ) {
+        fputs( "could not create LCM instance\n", stderr );
+        exit( EXIT_FAILURE );
+    }
+
+    char tty[8] = { 0 };
+    sscanf( args.dev, "%*4c/%7s", tty );
+    char input_channel[sizeof( tty ) + strlen( INPUT_SUFFIX )];
+    strcpy( input_channel, tty );
+    strcat( input_channel, INPUT_SUFFIX );
+    char output_channel[sizeof( tty ) + strlen( OUTPUT_SUFFIX )];
+    strcpy( output_channel, tty );
+    strcat( output_channel, OUTPUT_SUFFIX );
+    char trace_channel[sizeof( tty ) + strlen( TRACE_SUFFIX )];
+    strcpy( trace_channel, tty );
+    strcat( trace_channel, TRACE_SUFFIX );
+    if( args.verbosity >= 0 ) {
+        printf( "input channel: %s\n", input_channel );
+        printf( "output channel: %s\n", output_channel );
+    }
+
+    shared_setup( &args.shared, args.verbosity, lio, &sfd, &tio,
+            input_channel, output_channel, trace_channel );
+
+    shared_realtime( &args.shared, args.verbosity );
+
+    int status = ( args.verbosity > 1 )
+        ? dispatch<Hexdump>( sfd, lio, output_channel )
+        : dispatch<Silent>( sfd, lio, output_channel );
+
+    if( -1 != latency.fd ) close( latency.fd );
+    lcm_destroy( lio );
+    close( sfd );
+
+    exit( status );
+}
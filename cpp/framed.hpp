@@ -0,0 +1,134 @@
+// framed.hpp
+//
+// Command-line interface for framed-serial-lcm-bridge.
+//
+// Same options as serial-lcm-bridge (see c/complex.h, and c/shared.h for
+// the ones both take), plus the layout of preamble-delimited binary packets.
+
+#ifndef FRAMED_HPP_
+#define FRAMED_HPP_
+
+#include <cstring>        // for std::strcmp
+
+#include "framers.hpp"    // for max_preamble_length
+
+enum checksum_t { CHECKSUM_NONE, CHECKSUM_XMODEM, CHECKSUM_CRC32 };
+
+static char doc[] = "framed-serial-lcm-bridge -- a bridge between serial device"
+    " and LCM, with framing compiled per mode";
+static char args_doc[] = "device";
+
+static struct argp_option options[] = {
+    { "verbose", 'v', 0, 0, "say more" },
+    { "quiet", 'q', 0, 0, "say less" },
+    { "baudrate", 'b', "baudrate", 0, "baudrate" },
+    { "terminator", 't', "terminator", 0, "terminator" },
+    { "initiator", 'i', "initiator", 0, "initiator" },
+    { "preamble", 'P', "hex", 0, "preamble of binary packets, e.g., 80808080" },
+    { "header-size", 'H', "bytes", 0, "size of the header after the preamble" },
+    { "length-offset", 'L', "bytes", 0,
+        "offset in the header of the uint32 payload length" },
+    { "checksum", 'c', "name", 0, "payload checksum: none, xmodem or crc32" },
+    { 0 }
+};
+
+struct arguments {
+    char * dev;
+    int8_t verbosity;
+    speed_t baudrate;
+    uint8_t terminator;
+    uint8_t initiator;
+    uint8_t preamble[max_preamble_length];
+    size_t preamble_length;
+    size_t header_size;
+    size_t length_offset;
+    checksum_t checksum;
+    struct shared_arguments shared;
+};
+
+static error_t parse_opt( int key, char *arg, struct argp_state *state ) {
+    struct arguments *args = static_cast<struct arguments *>( state->input );
+    int n = 0;
+    switch( key ){
+        case ARGP_KEY_INIT:
+            state->child_inputs[0] = &(args->shared);
+            break;
+        case 'q':
+            args->verbosity = -1;
+            break;
+        case 'v':
+            args->verbosity += 1;
+            break;
+        case 'b':
+            args->baudrate = char_to_baudrate( arg );
+            break;
+        case 't':
+            if( 1 != sscanf( arg, "%02hhx", &(args->terminator) ) ) {
+                argp_usage( state );
+            }
+            break;
+        case 'i':
+            if( 1 != sscanf( arg, "%02hhx", &(args->initiator) ) ) {
+                argp_usage( state );
+            }
+            break;
+        case 'P':
+            args->preamble_length = 0;
+            while( args->preamble_length < max_preamble_length
+                    && 1 == sscanf( arg, "%02hhx%n",
+                        &(args->preamble[args->preamble_length]), &n ) ) {
+                args->preamble_length++;
+                arg += n;
+            }
+            if( 0 == args->preamble_length || '\0' != *arg ) {
+                argp_error( state, "preamble must be 1 to %zu hex bytes",
+                        max_preamble_length );
+            }
+            break;
+        case 'H':
+            args->header_size = strtoul( arg, NULL, 0 );
+            break;
+        case 'L':
+            args->length_offset = strtoul( arg, NULL, 0 );
+            break;
+        case 'c':
+            if( 0 == std::strcmp( arg, "none" ) ) {
+                args->checksum = CHECKSUM_NONE;
+            } else if( 0 == std::strcmp( arg, "xmodem" ) ) {
+                args->checksum = CHECKSUM_XMODEM;
+            } else if( 0 == std::strcmp( arg, "crc32" ) ) {
+                args->checksum = CHECKSUM_CRC32;
+            } else {
+                argp_usage( state );
+            }
+            break;
+        case ARGP_KEY_ARG:
+            if( state->arg_num >= 1 ) argp_usage( state );
+            args->dev = arg;
+            break;
+        case ARGP_KEY_END:
+            if( state->arg_num < 1 ) argp_usage( state );
+            if( args->preamble_length
+                    && args->header_size < args->length_offset + 4 ) {
+                argp_error( state, "header must hold the uint32 payload length" );
+            }
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+static struct argp argp = { options, parse_opt, args_doc, doc,
+    shared_children };
+
+struct arguments args;
+
+// same settings as c/complex.h, filled in by `main` (C++ has no designated
+// initializers for the c_cc array)
+struct termios tio;
+
+// so that stdout is not allocated lazily in realtime mode
+char stdout_buffer[BUFSIZ];
+
+#endif // FRAMED_HPP_
@@ -0,0 +1,278 @@
+// framers.hpp
+//
+// Framing policies for framed-serial-lcm-bridge.
+//
+// Each framer consumes whatever `read()` returned from the serial port and
+// calls `emit(arrival, data, length)` for every complete frame, with the
+// `Arrival` of the read that held its first byte. The framing
+// mode, checksum and verbosity are template parameters, so `main` picks one
+// instantiation at startup and the hot loop has no per-byte mode switches.
+//
+// Framers keep their state between calls, so a frame may span many reads
+// and a read may contain many frames.
+
+#ifndef FRAMERS_HPP_
+#define FRAMERS_HPP_
+
+#include <algorithm>      // for std::min
+#include <array>          // for std::array
+#include <cstddef>        // for std::size_t
+#include <cstdint>        // for std::int64_t, std::uint8_t, std::uint32_t
+#include <cstdio>         // for std::fprintf
+#include <cstring>        // for std::memchr, std::memcpy
+
+
+// same as MAX_LENGTH in c/complex.h
+constexpr std::size_t max_frame_length = 4096;
+
+// longest preamble accepted by `Preambled`
+constexpr std::size_t max_preamble_length = 32;
+
+
+// when the bytes passed to `feed` were read: the epoch time in microseconds
+// that becomes the frame's utime, and the monotonic times in nanoseconds of
+// the wakeup and read that brought them, for latency tracing (0 if not)
+//
+struct Arrival{
+    std::int64_t utime;
+    std::int64_t wake;
+    std::int64_t read;
+};
+
+
+// fixed-capacity frame under construction
+//
+struct Frame{
+    Arrival arrival;              // of its first byte
+    std::size_t length;
+    std::array<std::uint8_t, max_frame_length> data;
+
+    Frame() : arrival(), length(0), data() {}
+
+    // append up to `size` bytes, returning how many fit
+    std::size_t append(const std::uint8_t *bytes, std::size_t size)
+    {
+        std::size_t n = std::min(size, max_frame_length - length);
+        std::memcpy(&data[length], bytes, n);
+        length += n;
+        return n;
+    }
+
+    bool full(void) const { return max_frame_length == length; }
+};
+
+
+// frames that end with a terminator (serial-lcm-bridge without -i)
+//
+template<class Trace>
+class Terminated{
+public:
+    explicit Terminated(std::uint8_t terminator)
+    : terminator(terminator), frame()
+    {}
+
+    template<class Emit>
+    void feed(const std::uint8_t *data, std::size_t size,
+            const Arrival &arrival, Emit &emit)
+    {
+        while(size > 0){
+            if(0 == frame.length) frame.arrival = arrival;
+            std::size_t room = std::min(size, max_frame_length - frame.length);
+            const void *end = std::memchr(data, terminator, room);
+            std::size_t n = end ? static_cast<const std::uint8_t *>(end) - data + 1
+                                : room;
+            frame.append(data, n);
+            data += n;
+            size -= n;
+            if(end){
+                Trace::framed(frame.data.data(), frame.length);
+                emit(frame.arrival, frame.data.data(), frame.length);
+                frame.length = 0;
+            } else if(frame.full()){
+                std::fprintf(stderr, "terminator not found, sending %zu bytes\n",
+                        frame.length);
+                emit(frame.arrival, frame.data.data(), frame.length);
+                frame.length = 0;
+            }
+        }
+    }
+
+private:
+    const std::uint8_t terminator;
+    Frame frame;
+};
+
+
+// frames that start with an initiator and end with a terminator
+// (serial-lcm-bridge with -i different from -t)
+//
+template<class Trace>
+class Delimited{
+public:
+    Delimited(std::uint8_t initiator, std::uint8_t terminator)
+    : initiator(initiator), terminator(terminator), started(false), frame()
+    {}
+
+    template<class Emit>
+    void feed(const std::uint8_t *data, std::size_t size,
+            const Arrival &arrival, Emit &emit)
+    {
+        while(size > 0){
+            if(!started){
+                const void *begin = std::memchr(data, initiator, size);
+                std::size_t skip = begin
+                    ? static_cast<const std::uint8_t *>(begin) - data : size;
+                Trace::skipped(data, skip);
+                data += skip;
+                size -= skip;
+                if(!begin) return;
+                started = true;
+                frame.arrival = arrival;
+                frame.length = 0;
+                frame.append(data, 1);
+                ++data;
+                --size;
+                continue;
+            }
+            std::size_t room = std::min(size, max_frame_length - frame.length);
+            const void *end = std::memchr(data, terminator, room);
+            std::size_t n = end ? static_cast<const std::uint8_t *>(end) - data + 1
+                                : room;
+            frame.append(data, n);
+            data += n;
+            size -= n;
+            if(end){
+                Trace::framed(frame.data.data(), frame.length);
+                emit(frame.arrival, frame.data.data(), frame.length);
+                started = false;
+            } else if(frame.full()){
+                std::fprintf(stderr, "terminator not found, sending %zu bytes\n",
+                        frame.length);
+                emit(frame.arrival, frame.data.data(), frame.length);
+                frame.length = 0;
+            }
+        }
+    }
+
+private:
+    const std::uint8_t initiator;
+    const std::uint8_t terminator;
+    bool started;
+    Frame frame;
+};
+
+
+// binary packets: preamble, fixed-size header carrying a little-endian
+// uint32 payload length, payload, then a checksum trailer
+// (the `BinaryLane` layout in python/bridge.py)
+//
+template<class Checksum, class Trace>
+class Preambled{
+public:
+    Preambled(const std::uint8_t *preamble, std::size_t preamble_length,
+            std::size_t header_size, std::size_t length_offset)
+    : pattern(), preamble_length(preamble_length), fallback(),
+      header_size(header_size), length_offset(length_offset),
+      matched(0), expected(0), frame()
+    {
+        std::memcpy(pattern.data(), preamble, preamble_length);
+        // failure function for resuming a partial preamble match
+        fallback[0] = 0;
+        for(std::size_t k = 1, m = 0; k < preamble_length; ++k){
+            while(m > 0 && pattern[k] != pattern[m]) m = fallback[m - 1];
+            if(pattern[k] == pattern[m]) ++m;
+            fallback[k] = m;
+        }
+    }
+
+    template<class Emit>
+    void feed(const std::uint8_t *data, std::size_t size,
+            const Arrival &arrival, Emit &emit)
+    {
+        while(size > 0){
+            if(matched < preamble_length){
+                hunt(data, size, arrival);
+                continue;
+            }
+            std::size_t want = (0 == expected)
+                ? preamble_length + header_size : expected;
+            std::size_t n = frame.append(data, std::min(size, want - frame.length));
+            data += n;
+            size -= n;
+            if(frame.length < want) continue;
+            if(0 == expected){
+                expected = preamble_length + header_size + payload_length()
+                    + Checksum::size;
+                if(expected > max_frame_length){
+                    std::fprintf(stderr, "%zu-byte packet will not fit, "
+                            "discarding header\n", expected);
+                    restart();
+                    continue;
+                }
+                if(frame.length < expected) continue;
+            }
+            const std::uint8_t *payload = &frame.data[preamble_length + header_size];
+            std::size_t length = expected - preamble_length - header_size
+                - Checksum::size;
+            if(Checksum::check(payload, length, payload + length)){
+                Trace::framed(frame.data.data(), frame.length);
+                emit(frame.arrival, frame.data.data(), frame.length);
+            } else {
+                std::fprintf(stderr, "checksum mismatch in %zu-byte packet\n",
+                        frame.length);
+            }
+            restart();
+        }
+    }
+
+private:
+    // advance through `data` until the whole preamble has been seen
+    void hunt(const std::uint8_t *&data, std::size_t &size,
+            const Arrival &arrival)
+    {
+        const std::uint8_t *start = data;
+        while(size > 0 && matched < preamble_length){
+            while(matched > 0 && *data != pattern[matched]){
+                matched = fallback[matched - 1];
+            }
+            if(*data == pattern[matched]){
+                if(0 == matched) frame.arrival = arrival;
+                ++matched;
+            }
+            ++data;
+            --size;
+        }
+        // bytes still held in a (partial) match are not reported as skipped
+        std::size_t consumed = data - start;
+        Trace::skipped(start, consumed > matched ? consumed - matched : 0);
+        if(matched == preamble_length){
+            std::memcpy(frame.data.data(), pattern.data(), preamble_length);
+            frame.length = preamble_length;
+        }
+    }
+
+    std::size_t payload_length(void) const
+    {
+        const std::uint8_t *p = &frame.data[preamble_length + length_offset];
+        return std::uint32_t(p[0]) | std::uint32_t(p[1]) << 8
+            | std::uint32_t(p[2]) << 16 | std::uint32_t(p[3]) << 24;
+    }
+
+    void restart(void)
+    {
+        matched = 0;
+        expected = 0;
+        frame.length = 0;
+    }
+
+    std::array<std::uint8_t, max_preamble_length> pattern;
+    const std::size_t preamble_length;
+    std::array<std::size_t, max_preamble_length> fallback;
+    const std::size_t header_size;
+    const std::size_t length_offset;
+    std::size_t matched;
+    std::size_t expected;
+    Frame frame;
+};
+
+#endif // FRAMERS_HPP_
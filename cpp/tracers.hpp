@@ -0,0 +1,43 @@
+// tracers.hpp
+//
+// Verbosity policies for the framers in framers.hpp.
+//
+// `Silent` compiles to nothing, so the quiet hot loop carries no per-byte
+// test of the verbosity level; `Hexdump` mirrors what serial-lcm-bridge
+// prints with `-vv`.
+
+#ifndef TRACERS_HPP_
+#define TRACERS_HPP_
+
+#include <cstddef>        // for std::size_t
+#include <cstdint>        // for std::uint8_t
+#include <cstdio>         // for std::printf, std::putchar
+
+
+struct Silent{
+    static void skipped(const std::uint8_t *, std::size_t) {}
+
+    static void framed(const std::uint8_t *, std::size_t) {}
+};
+
+
+struct Hexdump{
+    // bytes discarded while searching for the start of a frame
+    static void skipped(const std::uint8_t *data, std::size_t size)
+    {
+        for(std::size_t k = 0; k < size; ++k){
+            std::printf("%02hhx ", data[k]);
+        }
+    }
+
+    static void framed(const std::uint8_t *data, std::size_t size)
+    {
+        std::printf("framed %zu bytes:", size);
+        for(std::size_t k = 0; k < size; ++k){
+            std::printf(" %02hhx", data[k]);
+        }
+        std::putchar('\n');
+    }
+};
+
+#endif // TRACERS_HPP_
@@ -0,0 +1,190 @@
+// demux_routes.c
+//
+// Check that frames are routed by address byte and by NMEA sentence ID (or
+// the longest prefix of it with a route), and that writes to a multi-drop
+// bus take turns: each route holds the bus until it answers or its response
+// window expires, which starts once a paced write has been sent.
+
+#define _GNU_SOURCE // for pipe2
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "r2_demux.h"
+
+#include <sys/timerfd.h>
+
+static int failures = 0;
+
+static void expect_route( struct r2_demux * d, const char * frame,
+        const char * expected ) {
+    const char * channel = r2_demux_frame( d, (const uint8_t *)frame,
+            strlen( frame ) );
+    if( strcmp( channel, expected ) ) {
+        printf( "FAIL: %s routed to %s, not %s\n", frame, channel, expected );
+        failures++;
+    }
+}
+
+// what the bridge wrote to the bus since last time
+static void expect_bus( int bus, const char * expected ) {
+    char written[64] = { 0 };
+    ssize_t n = read( bus, written, sizeof( written ) - 1 );
+    if( n < 0 ) n = 0;
+    written[n] = '\0';
+    if( strcmp( written, expected ) ) {
+        printf( "FAIL: bus got \"%s\", not \"%s\"\n", written, expected );
+        failures++;
+    }
+}
+
+
+static void addresses( void ) {
+    struct r2_demux * d = r2_demux_open( R2_DEMUX_ADDRESS, 1, -1, 0,
+            "TESTo", "TESTi" );
+    r2_demux_add( d, "01" );
+    r2_demux_add( d, "1f" );
+    if( -1 != r2_demux_add( d, "1F" ) || -1 != r2_demux_add( d, "100" ) ) {
+        puts( "FAIL: accepted a duplicate or invalid address" );
+        failures++;
+    }
+    expect_route( d, "\x02\x01payload\x03", "TESTo01" );
+    expect_route( d, "\x02\x1fpayload\x03", "TESTo1f" );
+    expect_route( d, "\x02\x33payload\x03", "TESTo" );
+    expect_route( d, "\x02", "TESTo" );
+    free( d );
+}
+
+
+static void sentences( void ) {
+    struct r2_demux * d = r2_demux_open( R2_DEMUX_NMEA, 0, -1, 0,
+            "TESTo", "TESTi" );
+    r2_demux_add( d, "GPGGA" );
+    r2_demux_add( d, "GP" );
+    r2_demux_add( d, "HE" );
+    r2_demux_add( d, "AIVDM" );
+    r2_demux_add( d, "PGRM" );
+    r2_demux_add( d, "GPG" );
+    expect_route( d, "$GPGGA,1,2,3*00\r\n", "TESTo" "GPGGA" );
+    expect_route( d, "$GPRMC,1,2,3*00\r\n", "TESTo" "GP" );
+    expect_route( d, "$GPGSV,1,2,3*00\r\n", "TESTo" "GPG" );
+    expect_route( d, "$PGRMZ,93,f,3*00\r\n", "TESTo" "PGRM" );
+    expect_route( d, "$PGRME,1,M*00\r\n", "TESTo" "PGRM" );
+    expect_route( d, "$PGRM,1*00\r\n", "TESTo" "PGRM" );
+    expect_route( d, "$PG*00\r\n", "TESTo" );
+    expect_route( d, "$HEHDT,1,T*00\r\n", "TESTo" "HE" );
+    expect_route( d, "!AIVDM,1,1,,A,0*00\r\n", "TESTo" "AIVDM" );
+    expect_route( d, "$IIMWV,1,R*00\r\n", "TESTo" );
+    expect_route( d, "GPGGA,1,2,3*00\r\n", "TESTo" );
+    free( d );
+}
+
+
+static void arbitration( void ) {
+    int bus[2];
+    if( -1 == pipe2( bus, O_NONBLOCK ) ) {
+        perror( "pipe2" );
+        exit( EXIT_FAILURE );
+    }
+    struct r2_demux * d = r2_demux_open( R2_DEMUX_ADDRESS, 0, bus[1], 20000,
+            "TESTo", "TESTi" );
+    int a = r2_demux_add( d, "0a" );
+    int b = r2_demux_add( d, "0b" );
+
+    // a gets the bus, b waits
+    r2_demux_write( &(d->routes[a]), 0, (const uint8_t *)"\x0a?", 2 );
+    r2_demux_write( &(d->routes[b]), 0, (const uint8_t *)"\x0b?", 2 );
+    expect_bus( bus[0], "\x0a?" );
+
+    // b talking out of turn does not end a's turn, but a answering does
+    expect_route( d, "\x0b!", "TESTo0b" );
+    expect_bus( bus[0], "" );
+    expect_route( d, "\x0a!", "TESTo0a" );
+    expect_bus( bus[0], "\x0b?" );
+
+    // b never answers, so its turn ends with the window
+    r2_demux_write( &(d->routes[a]), 0, (const uint8_t *)"\x0a?", 2 );
+    expect_bus( bus[0], "" );
+    struct pollfd timer = { d->tfd, POLLIN, 0 };
+    if( 1 != poll( &timer, 1, 1000 ) ) {
+        puts( "FAIL: response window did not expire" );
+        failures++;
+    }
+    r2_demux_timeout( d );
+    expect_bus( bus[0], "\x0a?" );
+
+    // a queue that is full drops writes instead of blocking
+    for( int k = 0; k <= R2_DEMUX_QUEUE; k++ ) {
+        r2_demux_write( &(d->routes[b]), 0, (const uint8_t *)"\x0b?", 2 );
+    }
+    if( R2_DEMUX_QUEUE != d->routes[b].head - d->routes[b].tail ) {
+        puts( "FAIL: full queue did not drop the extra write" );
+        failures++;
+    }
+
+    close( d->tfd );
+    free( d );
+    close( bus[0] );
+    close( bus[1] );
+}
+
+
+static int window_started( struct r2_demux * d ) {
+    struct itimerspec t;
+    timerfd_gettime( d->tfd, &t );
+    return t.it_value.tv_sec || t.it_value.tv_nsec;
+}
+
+
+static void paced_arbitration( void ) {
+    int bus[2];
+    if( -1 == pipe2( bus, O_NONBLOCK ) ) {
+        perror( "pipe2" );
+        exit( EXIT_FAILURE );
+    }
+    struct termios tio = { 0 };
+    tio.c_cflag = CS8 | CLOCAL | CREAD;
+    cfsetospeed( &tio, B115200 );
+    struct r2_demux * d = r2_demux_open( R2_DEMUX_ADDRESS, 0, bus[1], 20000,
+            "TESTo", "TESTi" );
+    int a = r2_demux_add( d, "0a" );
+    struct r2_txq * q = r2_txq_open( bus[1], &tio, 0, 5000,
+            R2_TXQ_FULL_DUPLEX, 0 );
+    r2_demux_pace( d, q );
+
+    // a character at a time, so the write takes a while to go out
+    r2_demux_write( &(d->routes[a]), 0, (const uint8_t *)"\x0a?", 2 );
+    if( window_started( d ) ) {
+        puts( "FAIL: response window started before the write was sent" );
+        failures++;
+    }
+    struct pollfd timer = { q->tfd, POLLIN, 0 };
+    while( q->current && 1 == poll( &timer, 1, 1000 ) ) r2_txq_service( q );
+    expect_bus( bus[0], "\x0a?" );
+    if( !window_started( d ) ) {
+        puts( "FAIL: response window did not start once the write was sent" );
+        failures++;
+    }
+
+    close( q->tfd );
+    free( q );
+    close( d->tfd );
+    free( d );
+    close( bus[0] );
+    close( bus[1] );
+}
+
+
+int main( int argc, char ** argv ) {
+    addresses();
+    sentences();
+    arbitration();
+    paced_arbitration();
+    if( 0 == failures ) puts( "routes and arbitration ok" );
+    exit( failures ? EXIT_FAILURE : EXIT_SUCCESS );
+}
@@ -0,0 +1,688 @@
+// simulate_instrument.c
+//
+// Emulate serial instruments on pseudo-terminals, so the bridges can be
+// exercised without hardware (or socat).
+//
+// Each simulated port is a pty with its own thread, emitting NMEA GPS
+// sentences, binary packets in the layout `BinaryLane` expects, the lines of
+// a script (including poll/response exchanges), or a raw capture file, at a
+// configurable rate with jitter, bit-flip noise and baudrate pacing.
+
+#define _GNU_SOURCE // for memmem, ppoll
+
+#include "config.h"
+
+#include <argp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+
+#define MAX_PORTS 256
+#define MAX_MESSAGE 8192
+#define MAX_ENTRIES 64
+#define MAX_REQUEST 1024
+#define PACE_CHUNK 16 // bytes written between baudrate pacing sleeps
+#define BITS_PER_BYTE 10 // 8N1: start + 8 data + stop
+#define NSEC_PER_SEC 1000000000LL
+
+const char *argp_program_version = PACKAGE_STRING;
+
+const char *argp_program_bug_address = PACKAGE_BUGREPORT;
+
+static char doc[] = "simulate-instrument -- emulate serial instruments on"
+    " pseudo-terminals\v"
+    "MODE is one of:\n"
+    "  nmea    GPS sentences (GGA and RMC, alternating)\n"
+    "  binary  BinaryLane packets: 16 bytes 0x80, four int32 header words"
+    " with the payload size third, payload, XMODEM checksum as uint32\n"
+    "  script  the lines of FILE, see below\n"
+    "  replay  the raw bytes of FILE (e.g., a capture from the device)\n"
+    "\n"
+    "Script lines are `text STRING`, `nmea BODY` (adds $, *checksum and"
+    " CRLF) or `hex BYTES`, sent in turn at RATE. After a `poll STRING` line,"
+    " the lines that follow are sent as the reply whenever STRING is read"
+    " from the port. STRING may contain \\r, \\n, \\t, \\\\ and \\xHH."
+    " Lines starting with # are ignored.";
+static char args_doc[] = "MODE [FILE]";
+
+static struct argp_option options[] = {
+    { "verbose", 'v', 0, 0, "say more" },
+    { "quiet", 'q', 0, 0, "say less" },
+    { "ports", 'n', "count", 0, "number of simulated ports (default 1)" },
+    { "link", 'l', "path", 0,
+        "symlink each pty to path with the port number appended" },
+    { "rate", 'r', "hz", 0, "messages per second per port, 0 for as fast as"
+        " pacing allows (default 1)" },
+    { "jitter", 'j', "usec", 0, "random delay added to each message" },
+    { "noise", 'e', "probability", 0, "chance of a flipped bit in each byte" },
+    { "baudrate", 'b', "baudrate", 0, "pace output as a UART at this rate"
+        " (default 0, unpaced)" },
+    { "size", 's', "bytes", 0, "binary payload size (default 512)" },
+    { "count", 'c', "messages", 0, "stop after this many messages per port" },
+    { 0 }
+};
+
+enum mode { MODE_NMEA, MODE_BINARY, MODE_SCRIPT, MODE_REPLAY };
+
+struct arguments {
+    enum mode mode;
+    char * file;
+    char * link;
+    int8_t verbosity;
+    int ports;
+    double rate;
+    long jitter;
+    double noise;
+    long baudrate;
+    size_t size;
+    uint64_t count;
+};
+
+static error_t parse_opt( int key, char *arg, struct argp_state *state ) {
+    struct arguments *args = state->input;
+    switch( key ){
+        case 'q':
+            args->verbosity = -1;
+            break;
+        case 'v':
+            args->verbosity += 1;
+            break;
+        case 'n':
+            args->ports = atoi( arg );
+            if( args->ports < 1 || args->ports > MAX_PORTS ) {
+                argp_error( state, "between 1 and %d ports", MAX_PORTS );
+            }
+            break;
+        case 'l':
+            args->link = arg;
+            break;
+        case 'r':
+            args->rate = strtod( arg, NULL );
+            break;
+        case 'j':
+            args->jitter = strtol( arg, NULL, 0 );
+            break;
+        case 'e':
+            args->noise = strtod( arg, NULL );
+            break;
+        case 'b':
+            args->baudrate = strtol( arg, NULL, 0 );
+            break;
+        case 's':
+            args->size = strtoul( arg, NULL, 0 );
+            if( args->size > MAX_MESSAGE - 64 ) {
+                argp_error( state, "payload size limited to %d bytes",
+                        MAX_MESSAGE - 64 );
+            }
+            break;
+        case 'c':
+            args->count = strtoull( arg, NULL, 0 );
+            break;
+        case ARGP_KEY_ARG:
+            if( 0 == state->arg_num ) {
+                if( 0 == strcmp( arg, "nmea" ) ) {
+                    args->mode = MODE_NMEA;
+                } else if( 0 == strcmp( arg, "binary" ) ) {
+                    args->mode = MODE_BINARY;
+                } else if( 0 == strcmp( arg, "script" ) ) {
+                    args->mode = MODE_SCRIPT;
+                } else if( 0 == strcmp( arg, "replay" ) ) {
+                    args->mode = MODE_REPLAY;
+                } else {
+                    argp_error( state, "unknown mode %s", arg );
+                }
+            } else if( 1 == state->arg_num ) {
+                args->file = arg;
+            } else {
+                argp_usage( state );
+            }
+            break;
+        case ARGP_KEY_END:
+            if( state->arg_num < 1 ) argp_usage( state );
+            if( ( MODE_SCRIPT == args->mode || MODE_REPLAY == args->mode )
+                    && NULL == args->file ) {
+                argp_error( state, "script and replay modes need a FILE" );
+            }
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+static struct argp argp = { options, parse_opt, args_doc, doc };
+
+struct arguments args;
+
+
+struct message {
+    uint8_t * data;
+    size_t length;
+};
+
+struct trigger {
+    struct message request;
+    size_t first; // index of the first reply in script.replies
+    size_t count;
+};
+
+struct script {
+    struct message periodic[MAX_ENTRIES];
+    size_t n_periodic;
+    struct trigger triggers[MAX_ENTRIES];
+    size_t n_triggers;
+    struct message replies[MAX_ENTRIES];
+    size_t n_replies;
+};
+
+struct script script;
+
+struct port {
+    int id;
+    int master;
+    int slave;
+    char name[64];
+    char link[256];
+    unsigned int seed;
+    struct timespec line_free; // when the simulated UART finishes sending
+    uint8_t request[MAX_REQUEST];
+    size_t request_length;
+    uint64_t messages;
+    uint64_t bytes;
+    uint64_t dropped;
+    pthread_t thread;
+};
+
+static struct port ports[MAX_PORTS];
+
+static volatile sig_atomic_t running = 1;
+
+
+static void stop( int signum ) {
+    running = 0;
+}
+
+
+static void timespec_add_nsec( struct timespec * t, int64_t nsec ) {
+    nsec += t->tv_nsec;
+    t->tv_sec += nsec / NSEC_PER_SEC;
+    t->tv_nsec = nsec % NSEC_PER_SEC;
+}
+
+
+static int timespec_before( const struct timespec * a, const struct timespec * b ) {
+    return a->tv_sec < b->tv_sec
+        || ( a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec );
+}
+
+
+// CRC-16/XMODEM, as crcmod's predefined 'xmodem' in python/bridge.py
+static uint16_t crc_xmodem( const uint8_t * data, size_t length ) {
+    uint16_t crc = 0;
+    for( size_t k = 0; k < length; k++ ) {
+        crc ^= (uint16_t)data[k] << 8;
+        for( int b = 0; b < 8; b++ ) {
+            crc = ( crc & 0x8000 ) ? ( crc << 1 ) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+
+static void put_le32( uint8_t * p, uint32_t v ) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+
+// `$BODY*HH\r\n`
+static size_t nmea_sentence( uint8_t * out, const char * body ) {
+    uint8_t checksum = 0;
+    for( const char * c = body; *c; c++ ) checksum ^= *c;
+    return sprintf( (char *)out, "$%s*%02X\r\n", body, checksum );
+}
+
+
+static size_t generate_nmea( struct port * p, uint64_t sequence, uint8_t * out ) {
+    // simulated time of day from the message sequence
+    double t = ( args.rate > 0 ) ? sequence / args.rate : sequence;
+    long centiseconds = (long)( t * 100 ) % ( 24 * 3600 * 100 );
+    int hh = centiseconds / 360000;
+    int mm = centiseconds / 6000 % 60;
+    int ss = centiseconds / 100 % 60;
+    int cs = centiseconds % 100;
+    // a position near Woods Hole, one per port, with some noise
+    double lat = 31.5 + p->id * 0.01 + ( rand_r( &p->seed ) % 1000 ) * 1e-6;
+    double lon = 40.3 + p->id * 0.01 + ( rand_r( &p->seed ) % 1000 ) * 1e-6;
+    char body[128];
+    if( sequence % 2 ) {
+        snprintf( body, sizeof( body ), "GPRMC,%02d%02d%02d.%02d,A,41%07.4f,N,"
+                "070%07.4f,W,%.1f,%.1f,191026,,,A", hh, mm, ss, cs, lat, lon,
+                ( rand_r( &p->seed ) % 50 ) / 10.0,
+                ( rand_r( &p->seed ) % 3600 ) / 10.0 );
+    } else {
+        snprintf( body, sizeof( body ), "GPGGA,%02d%02d%02d.%02d,41%07.4f,N,"
+                "070%07.4f,W,1,%02d,0.9,%.1f,M,-28.4,M,,", hh, mm, ss, cs,
+                lat, lon, 6 + rand_r( &p->seed ) % 6,
+                ( rand_r( &p->seed ) % 100 ) / 10.0 );
+    }
+    return nmea_sentence( out, body );
+}
+
+
+static size_t generate_binary( struct port * p, uint64_t sequence, uint8_t * out ) {
+    size_t length = 0;
+    memset( out, 0x80, 16 );
+    length += 16;
+    put_le32( out + length, sequence );
+    put_le32( out + length + 4, p->id );
+    put_le32( out + length + 8, args.size );
+    put_le32( out + length + 12, 0 );
+    length += 16;
+    // repetitive, ping-like payload with a little variation
+    uint8_t * payload = out + length;
+    for( size_t k = 0; k < args.size; k++ ) {
+        payload[k] = ( k * 7 + sequence ) & 0xff;
+        if( 0 == rand_r( &p->seed ) % 16 ) payload[k] ^= rand_r( &p->seed );
+    }
+    length += args.size;
+    put_le32( out + length, crc_xmodem( payload, args.size ) );
+    length += 4;
+    return length;
+}
+
+
+// decode \r, \n, \t, \\ and \xHH
+static size_t unescape( uint8_t * out, const char * in ) {
+    size_t length = 0;
+    while( *in && '\n' != *in ) {
+        if( '\\' != *in ) {
+            out[length++] = *in++;
+            continue;
+        }
+        in++;
+        switch( *in ) {
+            case 'r': out[length++] = '\r'; in++; break;
+            case 'n': out[length++] = '\n'; in++; break;
+            case 't': out[length++] = '\t'; in++; break;
+            case 'x':
+                if( 1 == sscanf( in + 1, "%2hhx", &out[length] ) ) {
+                    length++;
+                    in += 3;
+                    break;
+                }
+                // fall through
+            default:
+                out[length++] = *in ? *in++ : '\\';
+        }
+    }
+    return length;
+}
+
+
+static struct message parse_entry( const char * kind, const char * value,
+        const char * file, int line ) {
+    uint8_t data[MAX_MESSAGE];
+    struct message m = { 0 };
+    if( 0 == strcmp( kind, "text" ) || 0 == strcmp( kind, "poll" ) ) {
+        m.length = unescape( data, value );
+    } else if( 0 == strcmp( kind, "nmea" ) ) {
+        char body[MAX_MESSAGE / 2];
+        snprintf( body, sizeof( body ), "%.*s", (int)strcspn( value, "\r\n" ),
+                value );
+        m.length = nmea_sentence( data, body );
+    } else if( 0 == strcmp( kind, "hex" ) ) {
+        int n = 0;
+        while( m.length < sizeof( data )
+                && 1 == sscanf( value, " %2hhx%n", &data[m.length], &n ) ) {
+            m.length++;
+            value += n;
+        }
+    } else {
+        fprintf( stderr, "%s:%d: unknown entry '%s'\n", file, line, kind );
+        exit( EXIT_FAILURE );
+    }
+    m.data = malloc( m.length );
+    if( NULL == m.data ) {
+        perror( "malloc" );
+        exit( EXIT_FAILURE );
+    }
+    memcpy( m.data, data, m.length );
+    return m;
+}
+
+
+static void load_script( const char * file ) {
+    FILE * fp = fopen( file, "r" );
+    if( NULL == fp ) {
+        perror( "fopen()" );
+        fprintf( stderr, "could not open script %s\n", file );
+        exit( EXIT_FAILURE );
+    }
+    char line[MAX_MESSAGE];
+    char kind[16];
+    int n = 0;
+    for( int number = 1; fgets( line, sizeof( line ), fp ); number++ ) {
+        if( '#' == line[0] || 1 != sscanf( line, "%15s %n", kind, &n ) ) {
+            continue;
+        }
+        if( script.n_periodic == MAX_ENTRIES || script.n_triggers == MAX_ENTRIES
+                || script.n_replies == MAX_ENTRIES ) {
+            fprintf( stderr, "%s:%d: more than %d entries\n", file, number,
+                    MAX_ENTRIES );
+            exit( EXIT_FAILURE );
+        }
+        struct message m = parse_entry( kind, line + n, file, number );
+        if( 0 == strcmp( kind, "poll" ) ) {
+            struct trigger * t = &script.triggers[script.n_triggers++];
+            t->request = m;
+            t->first = script.n_replies;
+            t->count = 0;
+        } else if( script.n_triggers > 0 ) {
+            script.replies[script.n_replies++] = m;
+            script.triggers[script.n_triggers - 1].count++;
+        } else {
+            script.periodic[script.n_periodic++] = m;
+        }
+    }
+    fclose( fp );
+}
+
+
+static void load_replay( const char * file ) {
+    FILE * fp = fopen( file, "rb" );
+    if( NULL == fp ) {
+        perror( "fopen()" );
+        fprintf( stderr, "could not open capture %s\n", file );
+        exit( EXIT_FAILURE );
+    }
+    struct message m = { malloc( MAX_MESSAGE ), 0 };
+    size_t n = 0;
+    while( m.data && 0 < ( n = fread( m.data + m.length, 1, MAX_MESSAGE, fp ) ) ) {
+        m.length += n;
+        m.data = realloc( m.data, m.length + MAX_MESSAGE );
+    }
+    if( NULL == m.data || ferror( fp ) ) {
+        fprintf( stderr, "could not read capture %s\n", file );
+        exit( EXIT_FAILURE );
+    }
+    fclose( fp );
+    script.periodic[script.n_periodic++] = m;
+}
+
+
+// write like a UART: optionally bit-flipped, paced at the baudrate, and
+// dropping whatever the reader has not made room for
+static void transmit( struct port * p, const uint8_t * data, size_t length ) {
+    uint8_t noisy[PACE_CHUNK];
+    size_t sent = 0;
+    while( sent < length && running ) {
+        size_t n = length - sent;
+        const uint8_t * chunk = data + sent;
+        if( args.baudrate > 0 || args.noise > 0 ) {
+            n = ( n < PACE_CHUNK ) ? n : PACE_CHUNK;
+        }
+        if( args.noise > 0 ) {
+            for( size_t k = 0; k < n; k++ ) {
+                noisy[k] = chunk[k];
+                if( rand_r( &p->seed ) < args.noise * RAND_MAX ) {
+                    noisy[k] ^= 1 << ( rand_r( &p->seed ) % 8 );
+                }
+            }
+            chunk = noisy;
+        }
+        if( args.baudrate > 0 ) {
+            // the chunk arrives once its last stop bit has been sent
+            struct timespec now;
+            clock_gettime( CLOCK_MONOTONIC, &now );
+            if( timespec_before( &p->line_free, &now ) ) p->line_free = now;
+            timespec_add_nsec( &p->line_free,
+                    n * BITS_PER_BYTE * NSEC_PER_SEC / args.baudrate );
+            clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &p->line_free, NULL );
+        }
+        ssize_t w = write( p->master, chunk, n );
+        if( -1 == w && EINTR == errno ) {
+            continue;
+        } else if( -1 == w && EAGAIN == errno ) {
+            // nobody is reading fast enough: a real UART would overrun
+            p->dropped += length - sent;
+            return;
+        } else if( -1 == w ) {
+            perror( "write" );
+            running = 0;
+            return;
+        }
+        sent += w;
+        p->bytes += w;
+    }
+}
+
+
+// the first poll request in what has been read so far
+static const struct trigger * find_request( struct port * p, uint8_t ** at ) {
+    for( size_t t = 0; t < script.n_triggers; t++ ) {
+        *at = memmem( p->request, p->request_length,
+                script.triggers[t].request.data,
+                script.triggers[t].request.length );
+        if( *at ) return &script.triggers[t];
+    }
+    return NULL;
+}
+
+
+// read what has been written to the port, and reply to any poll it contains
+static void serve_requests( struct port * p ) {
+    ssize_t n = read( p->master, p->request + p->request_length,
+            MAX_REQUEST - p->request_length );
+    if( n <= 0 ) return;
+    p->request_length += n;
+    const struct trigger * trigger = NULL;
+    uint8_t * match = NULL;
+    while( NULL != ( trigger = find_request( p, &match ) ) ) {
+        if( args.verbosity > 1 ) {
+            printf( "port %d: poll %zu\n", p->id, trigger - script.triggers );
+        }
+        for( size_t r = 0; r < trigger->count; r++ ) {
+            const struct message * reply = &script.replies[trigger->first + r];
+            transmit( p, reply->data, reply->length );
+        }
+        p->messages++;
+        size_t used = match - p->request + trigger->request.length;
+        memmove( p->request, p->request + used, p->request_length - used );
+        p->request_length -= used;
+    }
+    if( MAX_REQUEST == p->request_length ) {
+        // no request in the whole buffer: keep the newer half
+        memmove( p->request, p->request + MAX_REQUEST / 2, MAX_REQUEST / 2 );
+        p->request_length = MAX_REQUEST / 2;
+    }
+}
+
+
+// sleep until `due` (forever if NULL), answering polls in the meantime
+static void wait_until( struct port * p, const struct timespec * due ) {
+    if( 0 == script.n_triggers ) {
+        if( due ) clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, due, NULL );
+        return;
+    }
+    struct pollfd pfd = { .fd = p->master, .events = POLLIN };
+    while( running ) {
+        struct timespec now, timeout;
+        clock_gettime( CLOCK_MONOTONIC, &now );
+        if( due ) {
+            if( !timespec_before( &now, due ) ) return;
+            int64_t remaining = ( due->tv_sec - now.tv_sec ) * NSEC_PER_SEC
+                + ( due->tv_nsec - now.tv_nsec );
+            timeout.tv_sec = remaining / NSEC_PER_SEC;
+            timeout.tv_nsec = remaining % NSEC_PER_SEC;
+        } else {
+            // wake up now and then to notice a signal
+            timeout.tv_sec = 0;
+            timeout.tv_nsec = 100000000;
+        }
+        if( 1 == ppoll( &pfd, 1, &timeout, NULL ) ) serve_requests( p );
+    }
+}
+
+
+static void * port_run( void * arg ) {
+    struct port * p = arg;
+    uint8_t message[MAX_MESSAGE];
+    struct timespec next;
+    clock_gettime( CLOCK_MONOTONIC, &next );
+    p->line_free = next;
+    int64_t period = ( args.rate > 0 ) ? NSEC_PER_SEC / args.rate : 0;
+
+    if( MODE_SCRIPT == args.mode && 0 == script.n_periodic ) {
+        // poll/response only
+        while( running && ( 0 == args.count || p->messages < args.count ) ) {
+            wait_until( p, NULL );
+        }
+        return NULL;
+    }
+
+    for( uint64_t sequence = 0; running
+            && ( 0 == args.count || sequence < args.count ); sequence++ ) {
+        struct timespec due = next;
+        if( args.jitter > 0 ) {
+            timespec_add_nsec( &due, ( rand_r( &p->seed ) % args.jitter ) * 1000LL );
+        }
+        wait_until( p, &due );
+
+        const uint8_t * data = message;
+        size_t length = 0;
+        switch( args.mode ) {
+            case MODE_NMEA:
+                length = generate_nmea( p, sequence, message );
+                break;
+            case MODE_BINARY:
+                length = generate_binary( p, sequence, message );
+                break;
+            default: {
+                const struct message * m =
+                    &script.periodic[sequence % script.n_periodic];
+                data = m->data;
+                length = m->length;
+            }
+        }
+        transmit( p, data, length );
+        p->messages++;
+        if( args.verbosity > 2 ) {
+            printf( "port %d: sent %zu bytes\n", p->id, length );
+        }
+        timespec_add_nsec( &next, period );
+    }
+    return NULL;
+}
+
+
+// closing the master discards whatever the reader has not read yet, so
+// wait for it to be read, giving up once the reader stops for a second
+static void port_drain( struct port * p ) {
+    int queued = 0;
+    int last = -1;
+    for( int idle = 0; running && idle < 100; idle++ ) {
+        if( -1 == ioctl( p->slave, FIONREAD, &queued ) || 0 == queued ) return;
+        if( queued != last ) idle = 0;
+        last = queued;
+        usleep( 10000 );
+    }
+}
+
+
+static void port_open( struct port * p ) {
+    p->master = posix_openpt( O_RDWR | O_NOCTTY | O_NONBLOCK );
+    if( -1 == p->master || -1 == grantpt( p->master )
+            || -1 == unlockpt( p->master )
+            || 0 != ptsname_r( p->master, p->name, sizeof( p->name ) ) ) {
+        perror( "posix_openpt" );
+        exit( EXIT_FAILURE );
+    }
+    // hold the slave open so the master never sees a hangup, and make it raw
+    // so nothing is echoed back before the bridge sets its own termios
+    p->slave = open( p->name, O_RDWR | O_NOCTTY );
+    struct termios tio;
+    if( -1 == p->slave || -1 == tcgetattr( p->slave, &tio ) ) {
+        perror( "open()" );
+        fprintf( stderr, "could not open pty %s\n", p->name );
+        exit( EXIT_FAILURE );
+    }
+    cfmakeraw( &tio );
+    tcsetattr( p->slave, TCSANOW, &tio );
+    if( args.link ) {
+        snprintf( p->link, sizeof( p->link ), "%s%d", args.link, p->id );
+        unlink( p->link );
+        if( -1 == symlink( p->name, p->link ) ) {
+            perror( "symlink" );
+            fprintf( stderr, "could not link %s to %s\n", p->link, p->name );
+            exit( EXIT_FAILURE );
+        }
+    }
+}
+
+
+int main( int argc, char ** argv ) {
+    args.verbosity = 0;
+    args.ports = 1;
+    args.rate = 1;
+    args.size = 512;
+    argp_parse( &argp, argc, argv, 0, 0, &args );
+
+    if( MODE_SCRIPT == args.mode ) {
+        load_script( args.file );
+    } else if( MODE_REPLAY == args.mode ) {
+        load_replay( args.file );
+    }
+
+    struct sigaction sa = { .sa_handler = stop };
+    sigaction( SIGINT, &sa, NULL );
+    sigaction( SIGTERM, &sa, NULL );
+
+    for( int k = 0; k < args.ports; k++ ) {
+        ports[k].id = k;
+        ports[k].seed = 1701 + k;
+        port_open( &ports[k] );
+        if( args.verbosity >= 0 ) {
+            printf( "port %d: %s%s%s\n", k, args.link ? ports[k].link : "",
+                    args.link ? " -> " : "", ports[k].name );
+        }
+    }
+    fflush( stdout );
+
+    for( int k = 0; k < args.ports; k++ ) {
+        if( 0 != pthread_create( &ports[k].thread, NULL, port_run, &ports[k] ) ) {
+            perror( "pthread_create" );
+            exit( EXIT_FAILURE );
+        }
+    }
+
+    int status = EXIT_SUCCESS;
+    for( int k = 0; k < args.ports; k++ ) {
+        pthread_join( ports[k].thread, NULL );
+        port_drain( &ports[k] );
+        if( args.verbosity >= 0 ) {
+            printf( "port %d: %" PRIu64 " messages, %" PRIu64 " bytes, %" PRIu64
+                    " bytes dropped\n", k, ports[k].messages, ports[k].bytes,
+                    ports[k].dropped );
+        }
+        if( ports[k].dropped ) status = EXIT_FAILURE;
+        if( args.link ) unlink( ports[k].link );
+        close( ports[k].slave );
+        close( ports[k].master );
+    }
+
+    exit( status );
+}
@@ -0,0 +1,165 @@
+// steady_state_alloc.c
+//
+// Check that serial-lcm-bridge does not allocate from the heap once it is
+// running: serial input is buffered, framed and encoded in memory allocated
+// up front, and LCM input is decoded in place. The same holds with latency
+// tracing on, since the trace ring is allocated up front too, and with
+// routes, a response window, a transmit queue and compression, whose frames
+// are routed by r2_demux_frame, written through r2_demux_write, r2_txq_push
+// and r2_txq_service, and handed to the compressor by zbytes_post.
+//
+// The bridge is compiled into this test with its main renamed; this file
+// supplies a counting malloc, calloc and realloc, and an lcm_publish that
+// stands in for the network. Only the bridge's own thread is counted, not
+// the compression worker. test/cpp/framed_steady_state.cpp does the same for
+// framed-serial-lcm-bridge.
+
+#define main serial_lcm_bridge_main
+#include "../../c/complex.c"
+#undef main
+
+#include <poll.h>
+
+extern void * __libc_malloc( size_t size );
+extern void * __libc_calloc( size_t count, size_t size );
+extern void * __libc_realloc( void * ptr, size_t size );
+
+static __thread int counting = 0;
+static size_t allocations = 0;
+
+void * malloc( size_t size ) {
+    if( counting ) allocations++;
+    return __libc_malloc( size );
+}
+
+void * calloc( size_t count, size_t size ) {
+    if( counting ) allocations++;
+    return __libc_calloc( count, size );
+}
+
+void * realloc( void * ptr, size_t size ) {
+    if( counting ) allocations++;
+    return __libc_realloc( ptr, size );
+}
+
+
+// the last message published, as LCM would deliver it to a subscriber
+static uint8_t published[sizeof( lcm_buffer )];
+static unsigned int published_size = 0;
+
+int lcm_publish( lcm_t * lcm, const char * channel, const void * data,
+        unsigned int size ) {
+#ifdef HAVE_ZSTD
+    // from the compression worker
+    if( strstr( channel, ZBYTES_SUFFIX ) ) return 0;
+#endif
+    memcpy( published, data, size );
+    published_size = size;
+    return 0;
+}
+
+
+// write to LCM as the bridge would: directly, or through the demux, on the
+// route the frame was read from, and wait for the transmit queue to send it
+static void lcm_to_serial( lcm_recv_buf_t * rbuf, const char * frame,
+        int * sfd ) {
+    if( NULL == demux ) {
+        raw_handler( rbuf, "TESTi", sfd );
+        return;
+    }
+    int r = r2_demux_lookup( demux, (const uint8_t *)frame, strlen( frame ) );
+    demux_handler( rbuf, demux->routes[r].input, &(demux->routes[r]) );
+    struct pollfd timer = { txq ? txq->tfd : -1, POLLIN, 0 };
+    while( txq && ( txq->current || txq->n ) && 1 == poll( &timer, 1, 1000 ) ) {
+        r2_txq_service( txq );
+    }
+}
+
+
+// pass each frame from serial to LCM and back again, counting allocations
+// after the first (warm-up) pass
+static int round_trip( const char * mode, const char * frame,
+        const char * expected, int passes ) {
+    int serial_in[2], serial_out[2];
+    if( -1 == pipe( serial_in ) || -1 == pipe( serial_out ) ) {
+        perror( "pipe" );
+        return 0;
+    }
+    // the demux and transmit queue write where this pass reads
+    if( demux ) demux->sfd = serial_out[1];
+    if( txq ) txq->sfd = serial_out[1];
+    FILE * sio = fdopen( serial_in[0], "rb" );
+    setvbuf( sio, sio_buffer, _IOFBF, sizeof( sio_buffer ) );
+    lcm_recv_buf_t rbuf = { .data = published };
+    char echo[MAX_LENGTH];
+    size_t length = strlen( expected );
+    int ok = 1;
+
+    allocations = 0;
+    for( int k = 0; k < passes && ok; k++ ) {
+        counting = ( k > 0 );
+        write( serial_in[1], frame, strlen( frame ) );
+        sio_handle( sio, "TESTo", NULL );
+        rbuf.data_size = published_size;
+        lcm_to_serial( &rbuf, expected, &serial_out[1] );
+        ok = ( length == read( serial_out[0], echo, sizeof( echo ) ) )
+            && 0 == memcmp( echo, expected, length );
+    }
+    counting = 0;
+
+    printf( "%s: %d passes, %zu allocations after warm-up%s\n", mode, passes,
+            allocations, ok ? "" : ", frame mismatch" );
+    fclose( sio );
+    close( serial_in[1] );
+    close( serial_out[0] );
+    close( serial_out[1] );
+    return ok && 0 == allocations;
+}
+
+
+int main( int argc, char ** argv ) {
+    int ok = 1;
+
+    args.verbosity = 0;
+    args.terminator = 0x0a;
+    args.initiator = args.terminator;
+    ok &= round_trip( "terminated", "$GPGGA,1,2,3*00\n", "$GPGGA,1,2,3*00\n",
+            1000 );
+
+    args.initiator = 0x02;
+    args.terminator = 0x03;
+    ok &= round_trip( "delimited", "noise\x02payload\x03", "\x02payload\x03",
+            1000 );
+
+    struct r2_trace_ring * ring = r2_trace_open();
+    ok &= round_trip( "traced", "noise\x02payload\x03", "\x02payload\x03",
+            1000 );
+    struct r2_trace_summary summary;
+    r2_trace_summarize( ring, &summary );
+    printf( "traced: %d frames, %d dropped\n", summary.count, summary.dropped );
+    ok &= ( 1000 == summary.count ) && ( 0 == summary.dropped );
+    for( int s = R2_TRACE_FRAMED; s < R2_TRACE_STAGES; s++ ) {
+        printf( "  %-9s %6" PRId64 " %6" PRId64 " %6" PRId64 " ns\n",
+                R2_TRACE_STAGE_NAMES[s], summary.min[s], summary.mean[s],
+                summary.max[s] );
+        ok &= ( 0 <= summary.min[s] );
+    }
+
+    // routed by sentence ID, holding the bus for a response, paced through
+    // a transmit queue, and compressed
+    args.initiator = '$';
+    args.terminator = '\n';
+    demux = r2_demux_open( R2_DEMUX_NMEA, 0, -1, 1000000, "TESTo", "TESTi" );
+    r2_demux_add( demux, "GPGGA" );
+    struct termios fast = tio;
+    cfsetospeed( &fast, B230400 );
+    txq = r2_txq_open( -1, &fast, 100, 0, R2_TXQ_FULL_DUPLEX, 0 );
+    r2_demux_pace( demux, txq );
+#ifdef HAVE_ZSTD
+    zbytes = zbytes_open( NULL, NULL );
+#endif
+    ok &= round_trip( "routed", "noise$GPGGA,1,2,3*00\n", "$GPGGA,1,2,3*00\n",
+            200 );
+
+    exit( ok ? EXIT_SUCCESS : EXIT_FAILURE );
+}
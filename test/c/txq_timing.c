@@ -0,0 +1,221 @@
+// txq_timing.c
+//
+// Check that the transmit queue keeps its gaps between frames and between
+// characters, and sends scheduled frames at their utime (converted to
+// CLOCK_MONOTONIC when queued), by timing the bytes as they come out of a
+// pipe standing in for the serial port. Also check that it reports each
+// frame once it has been sent, and that asking whether a frame has drained
+// never blocks, even on a pty that nobody reads.
+
+#define _GNU_SOURCE // for pipe2, posix_openpt
+
+#include "config.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "r2_txq.h"
+
+// how late the timer may wake on a loaded test machine
+#define SLACK 20000
+
+static int failures = 0;
+
+struct arrival {
+    uint8_t byte;
+    int64_t utime;
+};
+
+// service the queue until count bytes come out of the bus
+static int collect( struct r2_txq * q, int bus, struct arrival * arrivals,
+        int count ) {
+    int n = 0;
+    int64_t deadline = r2_epoch_usec_now() + 1000000;
+    while( n < count && r2_epoch_usec_now() < deadline ) {
+        struct pollfd fds[2] = { { q->tfd, POLLIN, 0 }, { bus, POLLIN, 0 } };
+        poll( fds, 2, 100 );
+        if( fds[0].revents & POLLIN ) r2_txq_service( q );
+        uint8_t byte;
+        while( n < count && 1 == read( bus, &byte, 1 ) ) {
+            arrivals[n].byte = byte;
+            arrivals[n].utime = r2_epoch_usec_now();
+            n++;
+        }
+    }
+    return n;
+}
+
+static void expect_between( const char * what, int64_t value, int64_t low,
+        int64_t high ) {
+    printf( "%s: %" PRId64 " us (expected %" PRId64 " to %" PRId64 ")\n",
+            what, value, low, high );
+    if( value < low || value > high ) {
+        printf( "FAIL: %s\n", what );
+        failures++;
+    }
+}
+
+
+static void frame_gap( int bus[2], const struct termios * tio ) {
+    struct r2_txq * q = r2_txq_open( bus[1], tio, 5000, 0,
+            R2_TXQ_FULL_DUPLEX, 0 );
+    for( int k = 0; k < 3; k++ ) {
+        r2_txq_push( q, 0, (const uint8_t *)"abcd", 4 );
+    }
+    struct arrival a[12];
+    if( 12 != collect( q, bus[0], a, 12 ) ) {
+        puts( "FAIL: frames did not all arrive" );
+        failures++;
+        return;
+    }
+    int64_t least = 4 * q->char_usec + q->frame_gap;
+    expect_between( "frame 1 to frame 2", a[4].utime - a[0].utime, least,
+            least + SLACK );
+    expect_between( "frame 2 to frame 3", a[8].utime - a[4].utime, least,
+            least + SLACK );
+    close( q->tfd );
+    free( q );
+}
+
+
+static uint64_t sent[4];
+static int nsent = 0;
+
+static void record_sent( void * user, uint64_t frame ) {
+    if( nsent < 4 ) sent[nsent] = frame;
+    nsent++;
+}
+
+
+// the sent handler hears of each frame once, in order, after its last byte
+static void sent_handler( int bus[2], const struct termios * tio ) {
+    struct r2_txq * q = r2_txq_open( bus[1], tio, 1000, 0,
+            R2_TXQ_FULL_DUPLEX, 0 );
+    q->sent_handler = &record_sent;
+    for( int k = 0; k < 3; k++ ) {
+        r2_txq_push( q, 0, (const uint8_t *)"abcd", 4 );
+    }
+    struct arrival a[12];
+    int n = collect( q, bus[0], a, 12 );
+    // and the last frame drains after its bytes are out
+    struct pollfd timer = { q->tfd, POLLIN, 0 };
+    while( nsent < 3 && 1 == poll( &timer, 1, 100 ) ) r2_txq_service( q );
+    if( 12 != n || 3 != nsent || 1 != sent[0] || 2 != sent[1] || 3 != sent[2] ) {
+        printf( "FAIL: %d frames reported sent, not frames 1, 2 and 3\n", nsent );
+        failures++;
+    } else {
+        puts( "sent handler: frames 1, 2 and 3" );
+    }
+    close( q->tfd );
+    free( q );
+}
+
+
+// a pty has no TIOCSERGETLSR, and its output is never read here, so
+// waiting for it to drain (as tcdrain would) would never return
+static void drain( const struct termios * tio ) {
+    int master = posix_openpt( O_RDWR | O_NOCTTY );
+    if( -1 == master || -1 == grantpt( master ) || -1 == unlockpt( master ) ) {
+        perror( "posix_openpt" );
+        failures++;
+        return;
+    }
+    int slave = open( ptsname( master ), O_RDWR | O_NOCTTY );
+    struct r2_txq * q = r2_txq_open( slave, tio, 0, 0, R2_TXQ_RTS, 0 );
+    write( slave, "abcdefgh", 8 );
+    alarm( 1 ); // fail, rather than hang, if it blocks
+    int64_t start = r2_txq_usec_now();
+    r2_txq_sent( q );
+    alarm( 0 );
+    expect_between( "asking if a pty has drained", r2_txq_usec_now() - start,
+            0, SLACK );
+    close( q->tfd );
+    free( q );
+    close( slave );
+    close( master );
+}
+
+
+static void char_gap( int bus[2], const struct termios * tio ) {
+    struct r2_txq * q = r2_txq_open( bus[1], tio, 0, 2000,
+            R2_TXQ_FULL_DUPLEX, 0 );
+    r2_txq_push( q, 0, (const uint8_t *)"abcd", 4 );
+    struct arrival a[4];
+    if( 4 != collect( q, bus[0], a, 4 ) || 'a' != a[0].byte
+            || 'd' != a[3].byte ) {
+        puts( "FAIL: characters did not all arrive in order" );
+        failures++;
+        return;
+    }
+    int64_t least = q->char_usec + q->char_gap;
+    for( int k = 1; k < 4; k++ ) {
+        expect_between( "character to character", a[k].utime - a[k - 1].utime,
+                least, least + SLACK );
+    }
+    close( q->tfd );
+    free( q );
+}
+
+
+static void scheduled( int bus[2], const struct termios * tio ) {
+    struct r2_txq * q = r2_txq_open( bus[1], tio, 0, 0,
+            R2_TXQ_FULL_DUPLEX, 1 );
+    int64_t due = r2_epoch_usec_now() + 30000;
+    r2_txq_push( q, due, (const uint8_t *)"L", 1 );
+    // held on CLOCK_MONOTONIC, so a step of the wall clock cannot move it
+    expect_between( "scheduled frame due in", q->order[0]->due
+            - r2_txq_usec_now(), 30000 - SLACK, 30000 );
+    r2_txq_push( q, 0, (const uint8_t *)"S", 1 );
+    struct arrival a[2];
+    if( 2 != collect( q, bus[0], a, 2 ) ) {
+        puts( "FAIL: scheduled frames did not all arrive" );
+        failures++;
+        return;
+    }
+    if( 'S' != a[0].byte || 'L' != a[1].byte ) {
+        puts( "FAIL: frame due now did not go before the one due later" );
+        failures++;
+    }
+    expect_between( "scheduled frame after its utime", a[1].utime - due, 0,
+            SLACK );
+
+    // and a full queue drops frames instead of blocking (the last frame may
+    // still hold its slot while it drains)
+    int dropped = 0;
+    int room = q->nfree;
+    for( int k = 0; k <= room; k++ ) {
+        dropped += ( -1 == r2_txq_push( q, due + 1000000, (const uint8_t *)"X", 1 ) );
+    }
+    if( 1 != dropped ) {
+        printf( "FAIL: full queue dropped %d frames, not 1\n", dropped );
+        failures++;
+    }
+    close( q->tfd );
+    free( q );
+}
+
+
+int main( int argc, char ** argv ) {
+    int bus[2];
+    if( -1 == pipe2( bus, O_NONBLOCK ) ) {
+        perror( "pipe2" );
+        exit( EXIT_FAILURE );
+    }
+    struct termios tio = { 0 };
+    tio.c_cflag = CS8 | CLOCAL | CREAD;
+    cfsetospeed( &tio, B115200 );
+
+    frame_gap( bus, &tio );
+    sent_handler( bus, &tio );
+    char_gap( bus, &tio );
+    scheduled( bus, &tio );
+    drain( &tio );
+
+    close( bus[0] );
+    close( bus[1] );
+    exit( failures ? EXIT_FAILURE : EXIT_SUCCESS );
+}
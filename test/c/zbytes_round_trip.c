@@ -0,0 +1,167 @@
+// zbytes_round_trip.c
+//
+// Check that frames published by a bridge come back intact from the
+// compressed channel, with and without a dictionary trained on frames like
+// them, and report how much smaller they are. Also check that a dictionary
+// without an ID (raw content, which readers could not find) is refused.
+//
+// This file supplies an lcm_publish that stands in for the network; the
+// worker thread calls it for the compressed frames.
+
+#include "config.h"
+
+#include "publish.h"
+
+#include <sys/wait.h>
+#include <zdict.h>
+
+#define FRAMES 1000
+#define FRAME_LENGTH 512
+#define SAMPLES 2000
+
+// a ping from an imaginary sonar: a fixed header, a counter, and echo
+// intensities that change a little from ping to ping
+static size_t ping( uint8_t * frame, uint32_t k ) {
+    memcpy( frame, "\x80\x80\x80\x80SONAR01", 11 );
+    memcpy( frame + 11, &k, sizeof( k ) );
+    for( size_t j = 15; j < FRAME_LENGTH; j++ ) {
+        frame[j] = (uint8_t)( ( j * 7 ) / 16 + ( ( k * 31 + j ) % 5 ) );
+    }
+    return FRAME_LENGTH;
+}
+
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t compressed[FRAMES][ZBYTES_ENCODED_SIZE( ZSTD_COMPRESSBOUND( FRAME_LENGTH ) )];
+static unsigned int compressed_size[FRAMES];
+static int ncompressed = 0;
+
+int lcm_publish( lcm_t * lcm, const char * channel, const void * data,
+        unsigned int size ) {
+    if( strcmp( channel, "TESTo" ZBYTES_SUFFIX ) ) return 0;
+    pthread_mutex_lock( &lock );
+    if( ncompressed < FRAMES && size <= sizeof( compressed[0] ) ) {
+        memcpy( compressed[ncompressed], data, size );
+        compressed_size[ncompressed] = size;
+        ncompressed++;
+    }
+    pthread_mutex_unlock( &lock );
+    return 0;
+}
+
+
+static int matched = 0;
+
+static void check( const char * channel, const raw_bytes_t * msg,
+        void * user ) {
+    uint8_t expected[FRAME_LENGTH];
+    ping( expected, (uint32_t)msg->utime );
+    if( FRAME_LENGTH == msg->length
+            && 0 == memcmp( expected, msg->data, msg->length ) ) {
+        matched++;
+    }
+}
+
+
+static int round_trip( const char * name, const char * dictionary ) {
+    static uint8_t buf[RAW_BYTES_ENCODED_SIZE( FRAME_LENGTH )];
+    uint8_t frame[FRAME_LENGTH];
+    raw_bytes_t msg;
+    msg.data = frame;
+
+    ncompressed = 0;
+    matched = 0;
+    zbytes = zbytes_open( NULL, dictionary );
+    for( uint32_t k = 0; k < FRAMES; k++ ) {
+        msg.utime = k;
+        msg.length = ping( frame, k );
+        raw_bytes_publish( NULL, "TESTo", &msg, buf, sizeof( buf ) );
+        // give the worker time, rather than counting drops as failures
+        while( ZBYTES_QUEUE / 2 < zbytes->head
+                - __atomic_load_n( &(zbytes->tail), __ATOMIC_ACQUIRE ) ) {
+            usleep( 100 );
+        }
+    }
+    while( zbytes->head != __atomic_load_n( &(zbytes->tail), __ATOMIC_ACQUIRE ) ) {
+        usleep( 100 );
+    }
+
+    struct zbytes_reader * reader = zbytes_reader_open( &check, NULL );
+    if( dictionary ) zbytes_reader_add_dictionary( reader, dictionary );
+    size_t total = 0;
+    for( int k = 0; k < ncompressed; k++ ) {
+        raw_zbytes_t z;
+        if( 0 > raw_zbytes_t_decode( compressed[k], 0, compressed_size[k], &z ) ) {
+            continue;
+        }
+        total += z.size;
+        zbytes_decompress( reader, "TESTo" ZBYTES_SUFFIX, &z );
+        raw_zbytes_t_decode_cleanup( &z );
+    }
+
+    printf( "%s: %d of %d frames intact, %zu bytes compressed to %zu (%.1fx)\n",
+            name, matched, FRAMES, (size_t)FRAMES * FRAME_LENGTH, total,
+            total ? (double)FRAMES * FRAME_LENGTH / total : 0.0 );
+    return FRAMES == matched;
+}
+
+
+// zbytes_open should exit, rather than compress with a dictionary that
+// frames could not name
+static int refuses_raw_dictionary( void ) {
+    char path[] = "/tmp/zbytes_round_trip.XXXXXX";
+    uint8_t frame[FRAME_LENGTH];
+    int fd = mkstemp( path );
+    if( -1 == fd || FRAME_LENGTH != write( fd, frame, ping( frame, 0 ) ) ) {
+        perror( "mkstemp" );
+        exit( EXIT_FAILURE );
+    }
+    close( fd );
+
+    int status = 0;
+    fflush( stdout ); // or the child would print it again
+    pid_t child = fork();
+    if( 0 == child ) {
+        zbytes_open( NULL, path );
+        _exit( EXIT_SUCCESS );
+    }
+    waitpid( child, &status, 0 );
+    unlink( path );
+    int refused = WIFEXITED( status ) && EXIT_FAILURE == WEXITSTATUS( status );
+    printf( "raw content dictionary: %s\n", refused ? "refused" : "accepted" );
+    return refused;
+}
+
+
+int main( int argc, char ** argv ) {
+    int ok = round_trip( "no dictionary", NULL );
+
+    // train a dictionary on pings like the ones sent
+    static uint8_t samples[SAMPLES * FRAME_LENGTH];
+    static size_t sample_sizes[SAMPLES];
+    for( uint32_t k = 0; k < SAMPLES; k++ ) {
+        sample_sizes[k] = ping( samples + k * FRAME_LENGTH, k + FRAMES );
+    }
+    static uint8_t dictionary[16 * 1024];
+    size_t size = ZDICT_trainFromBuffer( dictionary, sizeof( dictionary ),
+            samples, sample_sizes, SAMPLES );
+    if( ZDICT_isError( size ) ) {
+        fprintf( stderr, "could not train dictionary: %s\n",
+                ZDICT_getErrorName( size ) );
+        exit( EXIT_FAILURE );
+    }
+    char path[] = "/tmp/zbytes_round_trip.XXXXXX";
+    int fd = mkstemp( path );
+    if( -1 == fd || (ssize_t)size != write( fd, dictionary, size ) ) {
+        perror( "mkstemp" );
+        exit( EXIT_FAILURE );
+    }
+    close( fd );
+
+    ok &= round_trip( "trained dictionary", path );
+    unlink( path );
+
+    ok &= refuses_raw_dictionary();
+
+    exit( ok ? EXIT_SUCCESS : EXIT_FAILURE );
+}
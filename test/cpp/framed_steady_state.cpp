@@ -0,0 +1,206 @@
+// framed_steady_state.cpp
+//
+// test/c/steady_state_alloc.c for framed-serial-lcm-bridge: check that it
+// does not allocate from the heap once it is running, whichever framer feeds
+// its `Publisher`, with latency tracing on, and with routes, a response
+// window, a transmit queue and compression. Each frame arrives in several
+// reads, and a traced frame must be timed from the read of its first byte.
+//
+// The bridge is compiled into this test with its main renamed; this file
+// supplies a counting malloc, calloc and realloc (which operator new goes
+// through too), and an lcm_publish that stands in for the network. Only the
+// bridge's own thread is counted, not the compression worker.
+
+#include <algorithm>      // for std::min
+#include <vector>         // for std::vector
+
+#include <poll.h>         // for poll
+
+#define main framed_serial_lcm_bridge_main
+#include "../../cpp/framed.cpp"
+#undef main
+
+
+extern "C" {
+
+void *__libc_malloc(std::size_t size);
+void *__libc_calloc(std::size_t count, std::size_t size);
+void *__libc_realloc(void *ptr, std::size_t size);
+
+}
+
+static __thread bool counting = false;
+static std::size_t allocations = 0;
+
+extern "C" void *malloc(std::size_t size) noexcept
+{
+    if(counting) ++allocations;
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(std::size_t count, std::size_t size) noexcept
+{
+    if(counting) ++allocations;
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, std::size_t size) noexcept
+{
+    if(counting) ++allocations;
+    return __libc_realloc(ptr, size);
+}
+
+
+// the last message published, as LCM would deliver it to a subscriber
+static std::uint8_t published[RAW_BYTES_ENCODED_SIZE(max_frame_length)];
+static unsigned int published_size = 0;
+
+int lcm_publish(lcm_t *lcm, const char *channel, const void *data,
+        unsigned int size)
+{
+#ifdef HAVE_ZSTD
+    // from the compression worker
+    if(std::strstr(channel, ZBYTES_SUFFIX)) return 0;
+#endif
+    std::memcpy(published, data, size);
+    published_size = size;
+    return 0;
+}
+
+
+typedef std::vector<std::uint8_t> Bytes;
+
+static Bytes bytes(const char *text)
+{
+    return Bytes(text, text + std::strlen(text));
+}
+
+
+// write to LCM as the bridge would: directly, or through the demux, on the
+// route the frame was read from, and wait for the transmit queue to send it
+//
+static void lcm_to_serial(lcm_recv_buf_t *rbuf, const Bytes &frame, int *sfd)
+{
+    if(NULL == demux){
+        raw_handler(rbuf, "TESTi", sfd);
+        return;
+    }
+    int r = r2_demux_lookup(demux, frame.data(), frame.size());
+    demux_handler(rbuf, demux->routes[r].input, &(demux->routes[r]));
+    struct pollfd timer = { txq ? txq->tfd : -1, POLLIN, 0 };
+    while(txq && (txq->current || txq->n) && 1 == poll(&timer, 1, 1000)){
+        r2_txq_service(txq);
+    }
+}
+
+
+// pass `stream` from serial to LCM, in reads of `chunk` bytes `pause`
+// microseconds apart, and the frame in it back again, counting allocations
+// after the first (warm-up) pass
+//
+template<class Framer>
+static bool round_trip(const char *mode, Framer framer, const Bytes &stream,
+        std::size_t chunk, const Bytes &expected, int passes, int pause)
+{
+    int serial_out[2];
+    if(-1 == pipe(serial_out)){
+        std::perror("pipe");
+        return false;
+    }
+    // the demux and transmit queue write where this pass reads
+    if(demux) demux->sfd = serial_out[1];
+    if(txq) txq->sfd = serial_out[1];
+    Publisher publish(NULL, "TESTo");
+    lcm_recv_buf_t rbuf = {};
+    rbuf.data = published;
+    std::uint8_t echo[max_frame_length];
+    bool ok = true;
+
+    allocations = 0;
+    for(int k = 0; k < passes && ok; ++k){
+        counting = (k > 0);
+        for(std::size_t at = 0; at < stream.size(); at += chunk){
+            if(at && pause) usleep(pause);
+            // as `run` does for each read
+            R2_TRACE(R2_TRACE_WAKE);
+            Arrival arrival = { r2_epoch_usec_now(), 0, 0 };
+            R2_TRACE(R2_TRACE_READ);
+            if(r2_trace){
+                arrival.wake = r2_trace->current.t[R2_TRACE_WAKE];
+                arrival.read = r2_trace->current.t[R2_TRACE_READ];
+            }
+            framer.feed(&stream[at], std::min(chunk, stream.size() - at),
+                    arrival, publish);
+        }
+        rbuf.data_size = published_size;
+        lcm_to_serial(&rbuf, expected, &serial_out[1]);
+        ssize_t n = read(serial_out[0], echo, sizeof(echo));
+        ok = (ssize_t(expected.size()) == n)
+            && 0 == std::memcmp(echo, expected.data(), expected.size());
+    }
+    counting = false;
+
+    std::printf("%s: %d passes, %zu allocations after warm-up%s\n", mode,
+            passes, allocations, ok ? "" : ", frame mismatch");
+    close(serial_out[0]);
+    close(serial_out[1]);
+    return ok && 0 == allocations;
+}
+
+
+int main(void)
+{
+    bool ok = true;
+
+    Bytes sentence = bytes("$GPGGA,1,2,3*00\n");
+    ok &= round_trip("terminated", Terminated<Silent>('\n'), sentence, 5,
+            sentence, 1000, 0);
+
+    Bytes delimited = bytes("noise\x02payload\x03");
+    ok &= round_trip("delimited", Delimited<Silent>(0x02, 0x03), delimited, 5,
+            bytes("\x02payload\x03"), 1000, 0);
+
+    // as `-P 80808080 -H 16 -L 8 -c xmodem`, with the XMODEM check value
+    const std::uint8_t preamble[] = { 0x80, 0x80, 0x80, 0x80 };
+    Bytes packet(preamble, preamble + sizeof(preamble));
+    for(std::size_t k = 0; k < 16; ++k) packet.push_back(8 == k ? 9 : 0);
+    Bytes payload = bytes("123456789");
+    packet.insert(packet.end(), payload.begin(), payload.end());
+    const std::uint8_t trailer[] = { 0xc3, 0x31, 0x00, 0x00 };
+    packet.insert(packet.end(), trailer, trailer + sizeof(trailer));
+    ok &= round_trip("preambled", Preambled<Xmodem, Silent>(preamble,
+                sizeof(preamble), 16, 8), packet, 7, packet, 1000, 0);
+
+    // with reads 1 ms apart, each frame is framed at least 1 ms after the
+    // read that brought its first byte
+    struct r2_trace_ring *ring = r2_trace_open();
+    ok &= round_trip("traced", Delimited<Silent>(0x02, 0x03), delimited, 8,
+            bytes("\x02payload\x03"), 100, 1000);
+    struct r2_trace_summary summary;
+    r2_trace_summarize(ring, &summary);
+    std::printf("traced: %d frames, %d dropped, framed at least %" PRId64
+            " ns after the first read\n", summary.count, summary.dropped,
+            summary.min[R2_TRACE_FRAMED]);
+    ok &= (100 == summary.count) && (0 == summary.dropped)
+        && (1000000 <= summary.min[R2_TRACE_FRAMED]);
+    // and committing the last one left nothing behind for the next
+    for(int stage = 0; stage < R2_TRACE_STAGES; ++stage){
+        ok &= (0 == ring->current.t[stage]);
+    }
+
+    // routed by sentence ID, holding the bus for a response, paced through
+    // a transmit queue, and compressed
+    demux = r2_demux_open(R2_DEMUX_NMEA, 0, -1, 1000000, "TESTo", "TESTi");
+    r2_demux_add(demux, "GPGGA");
+    tio.c_cflag = CS8 | CLOCAL | CREAD;
+    cfsetospeed(&tio, B230400);
+    txq = r2_txq_open(-1, &tio, 100, 0, R2_TXQ_FULL_DUPLEX, 0);
+    r2_demux_pace(demux, txq);
+#ifdef HAVE_ZSTD
+    zbytes = zbytes_open(NULL, NULL);
+#endif
+    ok &= round_trip("routed", Terminated<Silent>('\n'), sentence, 5,
+            sentence, 200, 0);
+
+    std::exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,170 @@
+// framer_bench.cpp
+//
+// Compare the compile-time specialized framers in cpp/framers.hpp against a
+// loop that tests the runtime configuration for every byte, the way
+// `sio_handle` in c/complex.c does.
+//
+// Fails if the two disagree on the frames they produce; the timings are
+// informational, so the test does not depend on the speed of the machine.
+
+#include <chrono>         // for std::chrono::steady_clock
+#include <cstdint>        // for std::uint8_t, std::uint64_t
+#include <cstdio>         // for std::printf
+#include <cstdlib>        // for EXIT_SUCCESS, EXIT_FAILURE
+#include <random>         // for std::mt19937
+#include <vector>         // for std::vector
+
+#include "checksums.hpp"
+#include "framers.hpp"
+#include "tracers.hpp"
+
+
+// runtime configuration, as the `args` global in c/complex.h
+struct {
+    std::int8_t verbosity;
+    std::uint8_t terminator;
+    std::uint8_t initiator;
+} config;
+
+
+// byte-at-a-time framer that branches on `config` inside the loop
+//
+class Generic{
+public:
+    Generic() : started(false), frame() {}
+
+    template<class Emit>
+    void feed(const std::uint8_t *data, std::size_t size,
+            const Arrival &arrival, Emit &emit)
+    {
+        for(std::size_t k = 0; k < size; ++k){
+            std::uint8_t b = data[k];
+            if(config.initiator != config.terminator && !started){
+                if(config.initiator != b){
+                    if(config.verbosity > 1) std::printf("%02hhx ", b);
+                    continue;
+                }
+                started = true;
+            }
+            if(0 == frame.length) frame.arrival = arrival;
+            frame.data[frame.length++] = b;
+            if(config.terminator == b){
+                if(config.verbosity > 1) Hexdump::framed(frame.data.data(), frame.length);
+                emit(frame.arrival, frame.data.data(), frame.length);
+                frame.length = 0;
+                started = false;
+            } else if(frame.full()){
+                emit(frame.arrival, frame.data.data(), frame.length);
+                frame.length = 0;
+            }
+        }
+    }
+
+private:
+    bool started;
+    Frame frame;
+};
+
+
+// summarizes emitted frames so that two framers can be compared
+//
+struct Tally{
+    std::uint64_t frames;
+    std::uint64_t bytes;
+    std::uint64_t hash;
+
+    void operator()(const Arrival &, const std::uint8_t *data, std::size_t length)
+    {
+        ++frames;
+        bytes += length;
+        for(std::size_t k = 0; k < length; ++k){
+            hash = (hash ^ data[k]) * 1099511628211ull; // FNV-1a
+        }
+    }
+
+    bool operator==(const Tally &other) const
+    {
+        return frames == other.frames && bytes == other.bytes
+            && hash == other.hash;
+    }
+};
+
+
+// feed `stream` to `framer` in tty-sized reads, returning seconds elapsed
+//
+template<class Framer>
+static double time_feed(Framer &framer, const std::vector<std::uint8_t> &stream,
+        Tally &tally)
+{
+    const std::size_t chunk = 256;
+    auto start = std::chrono::steady_clock::now();
+    for(std::size_t k = 0; k < stream.size(); k += chunk){
+        std::size_t n = std::min(chunk, stream.size() - k);
+        Arrival arrival = { std::int64_t(k), 0, 0 };
+        framer.feed(&stream[k], n, arrival, tally);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+
+// lines of printable text, optionally wrapped in STX/ETX with noise between
+//
+static std::vector<std::uint8_t> make_stream(std::size_t size, bool delimited)
+{
+    std::mt19937 rng(1701);
+    std::vector<std::uint8_t> stream;
+    stream.reserve(size + 128);
+    while(stream.size() < size){
+        if(delimited){
+            for(int k = rng() % 8; k > 0; --k) stream.push_back('a' + rng() % 26);
+            stream.push_back(0x02);
+        }
+        for(int k = 20 + rng() % 60; k > 0; --k) stream.push_back(' ' + rng() % 90);
+        stream.push_back(delimited ? 0x03 : 0x0a);
+    }
+    return stream;
+}
+
+
+template<class Fast>
+static bool compare(const char *mode, Fast fast,
+        const std::vector<std::uint8_t> &stream)
+{
+    Generic generic;
+    Tally slow_tally = {0, 0, 14695981039346656037ull};
+    Tally fast_tally = slow_tally;
+    double slow = time_feed(generic, stream, slow_tally);
+    double quick = time_feed(fast, stream, fast_tally);
+    double megabytes = stream.size() / 1e6;
+    std::printf("%-10s generic %7.1f MB/s, specialized %7.1f MB/s (%.1fx),"
+            " %llu frames\n", mode, megabytes / slow, megabytes / quick,
+            slow / quick, static_cast<unsigned long long>(fast_tally.frames));
+    if(!(slow_tally == fast_tally)){
+        std::printf("%s: framers disagree (%llu vs %llu frames)\n", mode,
+                static_cast<unsigned long long>(slow_tally.frames),
+                static_cast<unsigned long long>(fast_tally.frames));
+        return false;
+    }
+    return true;
+}
+
+
+int main(void)
+{
+    const std::size_t size = 1 << 24;
+    bool ok = true;
+
+    config.verbosity = 0;
+    config.terminator = 0x0a;
+    config.initiator = config.terminator;
+    ok &= compare("terminated", Terminated<Silent>(config.terminator),
+            make_stream(size, false));
+
+    config.terminator = 0x03;
+    config.initiator = 0x02;
+    ok &= compare("delimited", Delimited<Silent>(config.initiator,
+                config.terminator), make_stream(size, true));
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,145 @@
+// preambled_packets.cpp
+//
+// Check `Preambled` with the `Xmodem` and `Crc32` policies against packets
+// whose checksums come from the CRC catalogue rather than from boost: the
+// check value of each CRC over "123456789", and over "A".
+//
+// Each stream is fed whole and then split into reads of every size from 1
+// byte up, and must give the same frames every time. The streams include a
+// packet with a corrupted trailer, which must be dropped, and noise with
+// false starts of the preamble, which must be skipped.
+
+#include <algorithm>      // for std::min
+#include <cstdint>        // for std::uint8_t, std::uint32_t
+#include <cstdio>         // for std::printf
+#include <cstdlib>        // for EXIT_SUCCESS, EXIT_FAILURE
+#include <cstring>        // for std::strlen
+#include <vector>         // for std::vector
+
+#include "checksums.hpp"
+#include "framers.hpp"
+#include "tracers.hpp"
+
+
+typedef std::vector<std::uint8_t> Bytes;
+
+// as `-P 80808080 -H 16 -L 8`
+static const std::uint8_t preamble[] = { 0x80, 0x80, 0x80, 0x80 };
+constexpr std::size_t header_size = 16;
+constexpr std::size_t length_offset = 8;
+
+
+// preamble, header with the payload length, payload, little-endian trailer
+//
+static Bytes packet(const char *payload, std::uint32_t checksum)
+{
+    Bytes p(preamble, preamble + sizeof(preamble));
+    std::size_t length = std::strlen(payload);
+    for(std::size_t k = 0; k < header_size; ++k){
+        std::size_t shift = 8 * (k - length_offset);
+        p.push_back(k >= length_offset && k < length_offset + 4
+                ? std::uint8_t(length >> shift) : std::uint8_t(0x55));
+    }
+    p.insert(p.end(), payload, payload + length);
+    for(std::size_t k = 0; k < 4; ++k) p.push_back(std::uint8_t(checksum >> (8 * k)));
+    return p;
+}
+
+
+static void append(Bytes &stream, const Bytes &bytes)
+{
+    stream.insert(stream.end(), bytes.begin(), bytes.end());
+}
+
+
+// keeps every frame emitted, and the utime it was stamped with
+//
+struct Frames{
+    std::vector<Bytes> frames;
+    std::vector<std::int64_t> utimes;
+
+    void operator()(const Arrival &arrival, const std::uint8_t *data,
+            std::size_t length)
+    {
+        frames.push_back(Bytes(data, data + length));
+        utimes.push_back(arrival.utime);
+    }
+};
+
+
+// feed `stream` in reads of `chunk` bytes, each stamped with its offset,
+// and compare the frames with `expected`, which start at `starts`
+//
+template<class Checksum>
+static bool check(const char *name, const Bytes &stream,
+        const std::vector<Bytes> &expected, const std::vector<std::size_t> &starts,
+        std::size_t chunk)
+{
+    Preambled<Checksum, Silent> framer(preamble, sizeof(preamble), header_size,
+            length_offset);
+    Frames got;
+    for(std::size_t k = 0; k < stream.size(); k += chunk){
+        std::size_t n = std::min(chunk, stream.size() - k);
+        Arrival arrival = { std::int64_t(k), 0, 0 };
+        framer.feed(&stream[k], n, arrival, got);
+    }
+    bool ok = (got.frames == expected);
+    for(std::size_t f = 0; ok && f < starts.size(); ++f){
+        // stamped with the read that held the first byte of the preamble
+        ok = (got.utimes[f] == std::int64_t(starts[f] - starts[f] % chunk));
+    }
+    if(!ok){
+        std::printf("FAIL: %s in %zu-byte reads: %zu frames, expected %zu\n",
+                name, chunk, got.frames.size(), expected.size());
+    }
+    return ok;
+}
+
+
+template<class Checksum>
+static bool run(const char *name, std::uint32_t check_value,
+        std::uint32_t check_a)
+{
+    Bytes good = packet("123456789", check_value);
+    Bytes bad = packet("123456789", check_value ^ 0x0100);
+    Bytes small = packet("A", check_a);
+
+    Bytes stream;
+    std::vector<std::size_t> starts;
+    // false starts: three of the four preamble bytes, then one
+    const std::uint8_t noise[] = { 'x', 0x80, 0x80, 0x80, 'y', 0x80, 'z' };
+    stream.insert(stream.end(), noise, noise + sizeof(noise));
+    starts.push_back(stream.size());
+    append(stream, good);
+    append(stream, bad);
+    stream.push_back(0x80);
+    stream.push_back(0x80);
+    stream.push_back('q');
+    starts.push_back(stream.size());
+    append(stream, small);
+    starts.push_back(stream.size());
+    append(stream, good);
+
+    std::vector<Bytes> expected;
+    expected.push_back(good);
+    expected.push_back(small);
+    expected.push_back(good);
+
+    bool ok = true;
+    for(std::size_t chunk = 1; chunk <= stream.size(); ++chunk){
+        ok &= check<Checksum>(name, stream, expected, starts, chunk);
+    }
+    std::printf("%s: %zu frames from %zu bytes in reads of 1 to %zu bytes: %s\n",
+            name, expected.size(), stream.size(), stream.size(),
+            ok ? "ok" : "failed");
+    return ok;
+}
+
+
+int main(void)
+{
+    bool ok = true;
+    ok &= run<Xmodem>("xmodem", 0x31c3, 0x58e5);
+    ok &= run<Crc32>("crc32", 0xcbf43926, 0xd3d99e8b);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
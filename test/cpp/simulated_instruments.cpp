@@ -0,0 +1,262 @@
+// simulated_instruments.cpp
+//
+// Run simulate-instrument and check what comes out of its ptys, through the
+// framers in cpp/framers.hpp:
+//
+// - binary mode on 20 ports as fast as it can go: every packet passes the
+//   XMODEM check in `Preambled`, and carries its port, sequence and size
+// - nmea mode on 20 ports: every sentence has the right checksum
+// - script mode with test/sim/poll_response.sim: each poll gets its reply
+//
+// simulate-instrument fails if any port dropped bytes because this end did
+// not keep up, so its exit status is checked too.
+
+#include <cstdint>        // for std::uint8_t, std::uint32_t
+#include <cstdio>         // for std::printf, std::fgets
+#include <cstdlib>        // for std::getenv, EXIT_SUCCESS, EXIT_FAILURE
+#include <cstring>        // for std::memcmp, std::strstr
+#include <string>         // for std::string
+#include <vector>         // for std::vector
+
+#include <fcntl.h>        // for open
+#include <poll.h>         // for poll
+#include <signal.h>       // for kill
+#include <sys/wait.h>     // for waitpid
+#include <termios.h>      // for cfmakeraw
+#include <time.h>         // for clock_gettime
+#include <unistd.h>       // for fork, execv, read, write
+
+#include "checksums.hpp"
+#include "framers.hpp"
+#include "tracers.hpp"
+
+
+constexpr int ports = 20;
+constexpr int count = 20;                 // messages per port
+constexpr std::uint32_t payload_size = 256;
+
+
+static double seconds_now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+
+// simulate-instrument in a child process, and the ptys it opened
+//
+struct Simulator{
+    pid_t pid;
+    FILE *out;
+    std::vector<int> fds;
+
+    // start it with `args`, and open the ptys it reports as raw
+    bool start(std::vector<const char *> args, int n)
+    {
+        int pipefd[2];
+        if(-1 == pipe(pipefd)) return false;
+        args.insert(args.begin(), "./simulate-instrument");
+        args.push_back(NULL);
+        pid = fork();
+        if(0 == pid){
+            dup2(pipefd[1], STDOUT_FILENO);
+            close(pipefd[0]);
+            execv(args[0], const_cast<char *const *>(args.data()));
+            std::perror("execv");
+            _exit(EXIT_FAILURE);
+        }
+        close(pipefd[1]);
+        out = fdopen(pipefd[0], "r");
+        char line[256];
+        char name[64];
+        for(int k = 0; k < n && std::fgets(line, sizeof(line), out); ++k){
+            if(1 != std::sscanf(line, "port %*d: %63s", name)) return false;
+            int fd = open(name, O_RDWR | O_NOCTTY | O_NONBLOCK);
+            struct termios tio;
+            if(-1 == fd || -1 == tcgetattr(fd, &tio)) return false;
+            cfmakeraw(&tio);
+            tcsetattr(fd, TCSANOW, &tio);
+            fds.push_back(fd);
+        }
+        return n == int(fds.size());
+    }
+
+    // wait for it to exit, or stop it first; true if it exited cleanly
+    bool finish(bool stop)
+    {
+        if(stop) kill(pid, SIGTERM);
+        int status = 0;
+        waitpid(pid, &status, 0);
+        for(int fd : fds) close(fd);
+        std::fclose(out);
+        return WIFEXITED(status) && EXIT_SUCCESS == WEXITSTATUS(status);
+    }
+};
+
+
+static std::uint32_t le32(const std::uint8_t *p)
+{
+    return std::uint32_t(p[0]) | std::uint32_t(p[1]) << 8
+        | std::uint32_t(p[2]) << 16 | std::uint32_t(p[3]) << 24;
+}
+
+
+// binary packets from one port: header words are the sequence, the port,
+// the payload size and 0
+//
+struct Packets{
+    std::uint32_t port;
+    int frames;
+    bool ok;
+
+    void operator()(const Arrival &, const std::uint8_t *data, std::size_t length)
+    {
+        ok &= (16 + 16 + payload_size + 4 == length)
+            && le32(data + 16) == std::uint32_t(frames)
+            && le32(data + 20) == port && le32(data + 24) == payload_size
+            && 0 == le32(data + 28);
+        ++frames;
+    }
+};
+
+
+// NMEA sentences from one port: `$BODY*HH\r\n`, HH the XOR of BODY
+//
+struct Sentences{
+    std::uint32_t port;
+    int frames;
+    bool ok;
+
+    void operator()(const Arrival &, const std::uint8_t *data, std::size_t length)
+    {
+        std::uint8_t sum = 0;
+        std::size_t k = 1;
+        for(; k < length && '*' != data[k]; ++k) sum ^= data[k];
+        unsigned int stated = 0x100;
+        ok &= length > 6 && '$' == data[0] && k + 5 == length
+            && 1 == std::sscanf(reinterpret_cast<const char *>(data) + k + 1,
+                    "%2X", &stated)
+            && sum == stated && 0 == std::memcmp(data + k + 3, "\r\n", 2);
+        ++frames;
+    }
+};
+
+
+// feed each pty to its own framer until every port has sent `count`
+//
+template<class Framer, class Sink>
+static bool collect(const char *mode, Simulator &sim, Framer prototype)
+{
+    std::vector<Framer> framers(ports, prototype);
+    std::vector<Sink> sinks;
+    std::vector<struct pollfd> fds;
+    for(int k = 0; k < ports; ++k){
+        Sink sink = { std::uint32_t(k), 0, true };
+        sinks.push_back(sink);
+        struct pollfd p = { sim.fds[k], POLLIN, 0 };
+        fds.push_back(p);
+    }
+    std::uint8_t buffer[4096];
+    Arrival arrival = { 0, 0, 0 };
+    int done = 0;
+    for(double deadline = seconds_now() + 10; done < ports
+            && seconds_now() < deadline; ){
+        poll(fds.data(), fds.size(), 100);
+        done = 0;
+        for(int k = 0; k < ports; ++k){
+            ssize_t n = read(fds[k].fd, buffer, sizeof(buffer));
+            if(n > 0) framers[k].feed(buffer, n, arrival, sinks[k]);
+            done += (count <= sinks[k].frames);
+        }
+    }
+    bool ok = sim.finish(false);
+    int frames = 0;
+    for(int k = 0; k < ports; ++k){
+        frames += sinks[k].frames;
+        ok &= sinks[k].ok && count == sinks[k].frames;
+    }
+    std::printf("%s: %d frames from %d ports, expected %d: %s\n", mode, frames,
+            ports, ports * count, ok ? "ok" : "failed");
+    return ok;
+}
+
+
+// write `request`, and read until `reply` turns up
+//
+static bool exchange(int fd, const std::string &request, const std::string &reply)
+{
+    if(ssize_t(request.size()) != write(fd, request.data(), request.size())){
+        return false;
+    }
+    std::string got;
+    char buffer[256];
+    for(double deadline = seconds_now() + 5; seconds_now() < deadline; ){
+        struct pollfd p = { fd, POLLIN, 0 };
+        poll(&p, 1, 100);
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if(n > 0) got.append(buffer, n);
+        if(std::string::npos != got.find(reply)) return true;
+    }
+    return false;
+}
+
+
+static bool poll_response(void)
+{
+    const char *srcdir = std::getenv("srcdir");
+    std::string script = std::string(srcdir ? srcdir : ".")
+        + "/test/sim/poll_response.sim";
+    Simulator sim;
+    std::vector<const char *> args = { "script", script.c_str(), "-r", "10" };
+    if(!sim.start(args, 1)){
+        std::printf("poll/response: could not start simulate-instrument\n");
+        return false;
+    }
+    // checksums worked out by hand
+    bool status = exchange(sim.fds[0], "", "$PXXX,STATUS,OK*18\r\n");
+    bool range = exchange(sim.fds[0], "?D\r", "D 12.5 m\r\n");
+    bool temperature = exchange(sim.fds[0], "junk?T\r",
+            std::string("$YXMTW,14.2,C*15\r\n\x06", 19));
+    sim.finish(true);
+    std::printf("poll/response: status %s, range %s, temperature %s\n",
+            status ? "ok" : "missing", range ? "ok" : "missing",
+            temperature ? "ok" : "missing");
+    return status && range && temperature;
+}
+
+
+int main(void)
+{
+    bool ok = true;
+    std::string n = std::to_string(ports);
+    std::string c = std::to_string(count);
+    std::string s = std::to_string(payload_size);
+
+    Simulator binary;
+    std::vector<const char *> args = { "binary", "-n", n.c_str(), "-r", "0",
+        "-c", c.c_str(), "-s", s.c_str() };
+    const std::uint8_t preamble[16] = { 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+        0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80 };
+    if(binary.start(args, ports)){
+        ok &= collect<Preambled<Xmodem, Silent>, Packets>("binary", binary,
+                Preambled<Xmodem, Silent>(preamble, 16, 16, 8));
+    } else {
+        std::printf("binary: could not start simulate-instrument\n");
+        ok = false;
+    }
+
+    Simulator nmea;
+    args = { "nmea", "-n", n.c_str(), "-r", "0", "-c", c.c_str() };
+    if(nmea.start(args, ports)){
+        ok &= collect<Terminated<Silent>, Sentences>("nmea", nmea,
+                Terminated<Silent>('\n'));
+    } else {
+        std::printf("nmea: could not start simulate-instrument\n");
+        ok = false;
+    }
+
+    ok &= poll_response();
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}